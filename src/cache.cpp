@@ -122,33 +122,45 @@ uint64_t Cache::access(MemReq &req) {
         bool updateReplacement = (req.type == GETS) || (req.type == GETX);
         int32_t lineId = array->lookup(req.lineAddr, &req, updateReplacement);
         respCycle += accLat;
+#if VALUE_TRACKING
         int32_t lookupLineId = lineId;
+#endif
 
         if (lineId == -1 && cc->shouldAllocate(req)) {
             //Make space for new line
             Address wbLineAddr;
-            char *wbLineValue = new char[(1U << lineBits)];
+            // The evicted value is only lent to the coherence controller (and the levels it writes back to) until
+            // processEviction() returns, so it lives on the stack; every level of a miss cascade gets its own
+            char wbLineValue[MAX_LINE_BYTES];
             lineId = array->preinsert(req.lineAddr, &req, &wbLineAddr, wbLineValue); //find the lineId to replace
 
             trace(Cache, "[%s] Evicting 0x%lx", name.c_str(), wbLineAddr);
 
             //Evictions are not in the critical path in any sane implementation -- we do not include their delays
             //NOTE: We might be "evicting" an invalid line for all we know. Coherence controllers will know what to do
-            cc->processEviction(req, wbLineAddr, wbLineValue, lineId,
-                                respCycle); //1. if needed, send invalidates/downgrades to lower level //hereeeee
-
-            delete[] wbLineValue;
+            cc->processEviction(req, wbLineAddr, wbLineValue, lineId, respCycle,
+                                array->mayBeDirty(lineId)); //1. if needed, send invalidates/downgrades to lower level //hereeeee
+
+            // Compressed arrays may need to replace more lines to make room
+            int32_t extraLineId;
+            while ((extraLineId = array->preinsertExtra(req.lineAddr, &req, &wbLineAddr, wbLineValue)) != -1) {
+                trace(Cache, "[%s] Evicting 0x%lx to make room", name.c_str(), wbLineAddr);
+                cc->processEviction(req, wbLineAddr, wbLineValue, extraLineId, respCycle,
+                                    array->mayBeDirty(extraLineId));
+            }
 
             array->postinsert(req.lineAddr, &req,
                               lineId); //do the actual insertion. NOTE: Now we must split insert into a 2-phase thing because cc unlocks us.
         }
 
         // SMF : when storing, if the lineAddr is present in the array, the value should be updated.
+#if VALUE_TRACKING
         if (lookupLineId != -1) {
             if (req.type == GETX or req.type == PUTS or req.type == PUTX) {
-                array->updateValue(req.value, req.size, req.line_offset, lineId);
+                array->updateValue(req.value, req.size, req.line_offset, lineId, req.pc, req.type);
             }
         }
+#endif
 
         // Enforce single-record invariant: Writeback access may have a timing
         // record. If so, read it.
@@ -272,45 +272,96 @@ DataAwareSetAssocArray::DataAwareSetAssocArray(uint32_t _numLines,
                                                ReplPolicy *_rp,
                                                HashFamily *_hf) : SetAssocArray(_numLines, _assoc, _rp, _hf),
                                                                   lineSize(_lineSize) {
-    values = gm_calloc<void *>(numLines);
-    dirty = gm_calloc<bool *>(numLines);
+    // dirty and zero words must fit a uint64_t, and LineSummary::classify() takes 16-byte chunks
+    assert(lineSize % 16 == 0 && lineSize / word_bytes <= 64);
+    // One allocation for all line values, so that big arrays do not take a trip through the global heap per line
+    values = gm_memalign<char>(CACHE_LINE_BYTES, (size_t) numLines * lineSize);
+    memset(values, 0, (size_t) numLines * lineSize);
+    dirty = gm_calloc<uint64_t>(numLines);
     write_counts = gm_calloc<int>(numLines);
+    lastEviction = {0, 0, lineSize / word_bytes};
+    silentStores = false;
+    storePCs = nullptr;
+    numStorePCs = 0;
+}
+
+void DataAwareSetAssocArray::enableSilentStores(uint32_t storePCEntries) {
+    assert(isPow2(storePCEntries));
+    silentStores = true;
+    numStorePCs = storePCEntries;
+    storePCs = gm_calloc<StorePC>(numStorePCs);
+}
 
-    for (unsigned int i = 0; i < numLines; ++i) {
-        values[i] = gm_calloc<char>(lineSize);
-        dirty[i] = gm_calloc<bool>(lineSize / word_bytes);
+void DataAwareSetAssocArray::profileStorePC(Address pc, bool silent) {
+    StorePC &e = storePCs[(pc ^ (pc >> 12)) & (numStorePCs - 1)];
+    if (e.pc != pc) {
+        if (e.conf) {
+            e.conf--;
+            return;
+        }
+        e = {pc, 0, 0, 0};
     }
+    e.stores++;
+    if (silent) e.silent++;
+    if (e.conf < 16) e.conf++;
 }
 
 void DataAwareSetAssocArray::postinsert(const Address lineAddr, const MemReq *req, uint32_t candidate) {
     SetAssocArray::postinsert(lineAddr, req, candidate);
-    memcpy(values[candidate], req->value, lineSize);
+#if VALUE_TRACKING  // otherwise, init rejects data-aware arrays
+    memcpy(lineValue(candidate), req->value, lineSize);
+#endif
 
 //    saed << req->type << " 0x" << setw(15) << std::hex << std::left << (array[candidate] << lineBits) + req->line_offset << " ";
 //    EmitMem(values[candidate], req->size, req->line_offset);
 
 
     // SMF : Bringing a new line into cache. all dirty set to false.
-    for (unsigned int i = 0; i < (lineSize / word_bytes); ++i) {
-        dirty[candidate][i] = false;
-    }
+    dirty[candidate] = 0;
     write_counts[candidate] = 0;
+
+    // A line filled by a store already has the stored bytes, and the old ones are not around to compare, so
+    // silent store detection counts them as changed
+    if (silentStores && req->type == GETX && req->size) dirty[candidate] = writtenWords(req->line_offset, req->size);
+}
+
+// Words of line with a byte in [begin, end) that differs from value; line must be 16-byte aligned. SSE2, like
+// LineSummary::classify()
+static inline uint64_t changedWords(const char *line, const char *value, uint32_t begin, uint32_t end) {
+    uint64_t changed = 0;
+    for (uint32_t c = begin & ~15u; c < end; c += 16) {
+        __m128i l = _mm_load_si128(reinterpret_cast<const __m128i *>(line + c));
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(value + c));
+        uint32_t diff = ~_mm_movemask_epi8(_mm_cmpeq_epi8(l, v)) & 0xffff;
+        uint32_t lo = MAX(begin, c) - c;
+        uint32_t hi = MIN(end, c + 16) - c;
+        diff &= ((1u << hi) - 1) & ~((1u << lo) - 1);
+        changed |= (uint64_t) (((diff & 0xff) != 0) | (((diff >> 8) != 0) << 1)) << (c / 8);
+    }
+    return changed;
 }
 
 
-void DataAwareSetAssocArray::updateValue(void *value, UINT32 size, unsigned int offset, uint32_t candidate) {
+void DataAwareSetAssocArray::updateValue(void *value, UINT32 size, unsigned int offset, uint32_t candidate,
+                                         Address pc, AccessType type) {
     unsigned int writeSize = MIN(lineSize - offset, size);
-    void *dst = (void *) ((uintptr_t) (values[candidate]) + offset);
+    void *dst = (void *) (lineValue(candidate) + offset);
     void *src = (void *) ((uintptr_t) (value) + offset);
-    memcpy(dst, src, writeSize);
-
-    int start_word = offset / word_bytes;
-    int end_word = (writeSize + offset - 1) / word_bytes;
 
     // SMF : setting the dirty bit for all the words that were affected by this operation.
-    for (int i = start_word; i <= end_word; ++i) {
-        dirty[candidate][i] = true;
+    uint64_t words = writtenWords(offset, size);
+    if (silentStores) {
+        words = changedWords(lineValue(candidate), (const char *) value, offset, offset + writeSize);
+        // Writebacks keep the dirty mask exact too, but only stores count as (silent) stores
+        if (type == GETX) {
+            profStores.inc();
+            profileStorePC(pc, !words);
+            if (!words) profSilentStores.inc();
+        }
+        if (!words) return;  // nothing to write
     }
+    memcpy(dst, src, writeSize);
+    dirty[candidate] |= words;
     write_counts[candidate]++;
 
 //    saed << "0x" << setw(15) << std::hex << std::left << (array[candidate] << lineBits) + offset << " ";
@@ -321,89 +372,286 @@ void DataAwareSetAssocArray::updateValue(void *value, UINT32 size, unsigned int
 uint32_t
 DataAwareSetAssocArray::preinsert(const Address lineAddr, const MemReq *req, Address *wbLineAddr, char *wbLineValue) {
     uint32_t candidate = SetAssocArray::preinsert(lineAddr, req, wbLineAddr, wbLineValue);
-    memcpy(wbLineValue, values[candidate], lineSize);
+    recordEviction(candidate, wbLineValue);
+    return candidate;
+}
+
+void DataAwareSetAssocArray::recordEviction(uint32_t candidate, char *wbLineValue) {
+    const char *value = lineValue(candidate);
+    memcpy(wbLineValue, value, lineSize);
 
     // l1 eviction here
-    unsigned int word_count = (lineSize / word_bytes);
-    unsigned int dirty_words = 0;
-    unsigned int zero_words = 0;
-
-    // for each word
-    for (unsigned int i = 0; i < word_count; ++i) {
-        if (dirty[candidate][i]) {
-            dirty_words++;
+    lastEviction = LineSummary::classify(value, lineSize / word_bytes, dirty[candidate]);
+    uint32_t dirty_words = lastEviction.numDirtyWords();
+    uint32_t zero_words = lastEviction.numZeroWords();
+
+    profEvictions.inc();
+    if (dirty_words) {
+        profDirtyEvictions.inc();
+        profDirtyLineZeroWords.inc(zero_words);
+    }
+    if (lastEviction.isZero()) profZeroEvictions.inc();
+    profDirtyWords.inc(dirty_words);
+    profWrites.inc(write_counts[candidate]);
+    profDirtyWordsHist.inc(dirty_words);
+    profZeroWordsHist.inc(zero_words);
+}
+
+void DataAwareSetAssocArray::initStats(AggregateStat *parentStat) {
+    AggregateStat *objStats = new AggregateStat();
+    objStats->init("array", "Data-aware array stats");
+    profEvictions.init("evictions", "Replaced lines");
+    objStats->append(&profEvictions);
+    profDirtyEvictions.init("dirtyEvictions", "Replaced lines with written words");
+    objStats->append(&profDirtyEvictions);
+    profZeroEvictions.init("zeroEvictions", "Replaced lines with all words zero");
+    objStats->append(&profZeroEvictions);
+    profDirtyWords.init("dirtyWords", "Written words in replaced lines");
+    objStats->append(&profDirtyWords);
+    profDirtyLineZeroWords.init("dirtyLineZeroWords", "Zero words in replaced lines with written words");
+    objStats->append(&profDirtyLineZeroWords);
+    profWrites.init("writes", "Writes to replaced lines while cached");
+    objStats->append(&profWrites);
+    profDirtyWordsHist.init("dirtyWordsHist", "Replaced lines by number of written words", lineSize / word_bytes + 1);
+    objStats->append(&profDirtyWordsHist);
+    profZeroWordsHist.init("zeroWordsHist", "Replaced lines by number of zero words", lineSize / word_bytes + 1);
+    objStats->append(&profZeroWordsHist);
+
+    if (silentStores) {
+        profStores.init("stores", "Stores (GETX) to cached lines");
+        objStats->append(&profStores);
+        profSilentStores.init("silentStores", "Stores that wrote what the line already held");
+        objStats->append(&profSilentStores);
+
+        // Per store PC, one entry per table slot (PC 0 if unused)
+        auto pcs = [this](uint32_t i) { return storePCs[i].pc; };
+        auto pcsStat = makeLambdaVectorStat(pcs, numStorePCs);
+        pcsStat->init("storePCs", "Profiled store PCs");
+        objStats->append(pcsStat);
+        auto pcStores = [this](uint32_t i) { return storePCs[i].stores; };
+        auto pcStoresStat = makeLambdaVectorStat(pcStores, numStorePCs);
+        pcStoresStat->init("storePCStores", "Stores (GETX) by each profiled PC");
+        objStats->append(pcStoresStat);
+        auto pcSilent = [this](uint32_t i) { return storePCs[i].silent; };
+        auto pcSilentStat = makeLambdaVectorStat(pcSilent, numStorePCs);
+        pcSilentStat->init("storePCSilent", "Silent stores (GETX) by each profiled PC");
+        objStats->append(pcSilentStat);
+    }
+    parentStat->append(objStats);
+}
+
+CompressedDataAwareSetAssoc::CompressedDataAwareSetAssoc(uint32_t _numLines, uint32_t _lineSize, uint32_t _assoc,
+                                                         uint32_t _dataWays, uint32_t _segmentBytes,
+                                                         Compressor _compressor, ReplPolicy *_rp, HashFamily *_hf)
+        : DataAwareSetAssocArray(_numLines, _lineSize, _assoc, _rp, _hf), compressor(_compressor),
+          segmentBytes(_segmentBytes) {
+    assert_msg(_dataWays && _dataWays <= assoc, "need 1 to %d data ways, you specified %d", assoc, _dataWays);
+    assert_msg(segmentBytes && lineSize % segmentBytes == 0 && lineSize / segmentBytes < 256,
+               "segment size (%d) must divide the line size (%d) in less than 256 segments", segmentBytes, lineSize);
+    segsPerLine = lineSize / segmentBytes;
+    setSegs = _dataWays * segsPerLine;
+    segs = gm_calloc<uint8_t>(numLines);
+    usedSegs = gm_calloc<uint32_t>(numSets);
+    extraCands = gm_calloc<ZWalkInfo>(assoc);
+    insCandidate = 0;
+    insSegs = 0;
+}
+
+// Does v fit in a signed integer of the given number of bytes?
+static inline bool fitsSigned(int64_t v, uint32_t bytes) {
+    if (bytes >= 8) return true;
+    int64_t lim = 1ll << (8 * bytes - 1);
+    return v >= -lim && v < lim;
+}
+
+static inline int64_t loadSigned(const char *p, uint32_t bytes) {
+    switch (bytes) {
+        case 1: return *(const int8_t *) p;
+        case 2: { int16_t v; memcpy(&v, p, 2); return v; }
+        case 4: { int32_t v; memcpy(&v, p, 4); return v; }
+        default: { int64_t v; memcpy(&v, p, 8); return v; }
+    }
+}
+
+// Base-Delta-Immediate: all values of baseBytes are within deltaBytes of zero or of a single base
+static bool bdiFits(const char *value, uint32_t lineSize, uint32_t baseBytes, uint32_t deltaBytes) {
+    bool haveBase = false;
+    int64_t base = 0;
+    for (uint32_t i = 0; i < lineSize; i += baseBytes) {
+        int64_t v = loadSigned(value + i, baseBytes);
+        if (fitsSigned(v, deltaBytes)) continue;  // immediate, i.e., delta from an implicit zero base
+        if (!haveBase) {
+            base = v;
+            haveBase = true;
         }
+        if (!fitsSigned(v - base, deltaBytes)) return false;
+    }
+    return true;
+}
 
+uint32_t CompressedDataAwareSetAssoc::bdiSize(const char *value, uint32_t lineSize) {
+    uint64_t first;
+    memcpy(&first, value, sizeof(first));
+    bool repeated = true;
+    for (uint32_t i = sizeof(first); i < lineSize && repeated; i += sizeof(first)) {
+        repeated = memcmp(value, value + i, sizeof(first)) == 0;
+    }
+    if (repeated) return first ? sizeof(first) : 1;
+
+    // Encodings as (base, delta) bytes, see Pekhimenko et al., PACT 2012
+    static const uint32_t encodings[][2] = {{8, 1}, {4, 1}, {8, 2}, {2, 1}, {4, 2}, {8, 4}};
+    uint32_t best = lineSize;
+    for (auto &enc : encodings) {
+        uint32_t size = enc[0] + lineSize / enc[0] * enc[1];
+        if (size < best && bdiFits(value, lineSize, enc[0], enc[1])) best = size;
+    }
+    return best;
+}
 
-        bool is_word_zero = true;
-        // for each byte in the word
-        for (unsigned int j = i * word_bytes; j < (i + 1) * word_bytes; ++j) {
-            if (((char **) values)[candidate][j] != 0) {
-                is_word_zero = false;
-            }
+// Frequent Pattern Compression, see Alameldeen and Wood, ISCA 2004: each 32-bit word is stored as a 3-bit
+// prefix plus the bits of its pattern; runs of up to 8 zero words share a prefix.
+uint32_t CompressedDataAwareSetAssoc::fpcSize(const char *value, uint32_t lineSize) {
+    uint32_t bits = 0;
+    uint32_t zeroRun = 0;
+    for (uint32_t i = 0; i < lineSize; i += 4) {
+        uint32_t w;
+        memcpy(&w, value + i, 4);
+        if (w == 0) {
+            if (zeroRun++ % 8 == 0) bits += 3 + 3;
+            continue;
         }
-        if(is_word_zero) {
-            zero_words ++;
+        zeroRun = 0;
+
+        int32_t sw = (int32_t) w;
+        int16_t lo = (int16_t) (w & 0xffff);
+        int16_t hi = (int16_t) (w >> 16);
+        if (sw >= -8 && sw < 8) {
+            bits += 3 + 4;
+        } else if (fitsSigned(sw, 1) || w == (w & 0xff) * 0x01010101u) {
+            bits += 3 + 8;  // sign-extended byte, or repeated bytes
+        } else if (fitsSigned(sw, 2) || lo == 0 || (fitsSigned(lo, 1) && fitsSigned(hi, 1))) {
+            bits += 3 + 16;  // sign-extended halfword, halfword padded with zeros, or two sign-extended bytes
+        } else {
+            bits += 3 + 32;
         }
     }
+    return MIN((bits + 7) / 8, lineSize);
+}
 
-    total_evictions++;
-
-    bool is_line_dirty = (dirty_words != 0);
-    bool is_line_zero = (zero_words == word_count);
+uint32_t CompressedDataAwareSetAssoc::compressedSegs(const char *value) const {
+    uint32_t size;
+    switch (compressor) {
+        case BDI: size = bdiSize(value, lineSize); break;
+        case FPC: size = fpcSize(value, lineSize); break;
+        default: size = MIN(bdiSize(value, lineSize), fpcSize(value, lineSize));
+    }
+    return (size + segmentBytes - 1) / segmentBytes;
+}
 
-    dirty_line_evictions += is_line_dirty ? 1 : 0;
-    zero_line_evictions += is_line_zero ? 1 : 0;
+uint32_t CompressedDataAwareSetAssoc::preinsert(const Address lineAddr, const MemReq *req, Address *wbLineAddr,
+                                                char *wbLineValue) {
+    insCandidate = DataAwareSetAssocArray::preinsert(lineAddr, req, wbLineAddr, wbLineValue);
+    insSegs = compressedSegs((const char *) req->value);
+    return insCandidate;
+}
 
-    dirty_word_evictions += dirty_words;
+int32_t CompressedDataAwareSetAssoc::preinsertExtra(const Address lineAddr, const MemReq *req, Address *wbLineAddr,
+                                                    char *wbLineValue) {
+    uint32_t set = insCandidate / assoc;
+    if (usedSegs[set] - segs[insCandidate] + insSegs <= setSegs) return -1;
 
-    if(is_line_dirty){
-        dirty_line_zero_word_evictions += zero_words;
+    // Replace the line the policy likes best among the others that hold data. There is one, as a single line
+    // fits an otherwise empty set.
+    uint32_t first = set * assoc;
+    uint32_t numCands = 0;
+    for (uint32_t id = first; id < first + assoc; id++) {
+        if (id != insCandidate && segs[id]) extraCands[numCands++].set(id, id, -1);
     }
+    assert(numCands);
+    uint32_t candidate = rp->rankCands(req, ZCands(extraCands, extraCands + numCands));
 
-    write_count_sum += write_counts[candidate];
+    *wbLineAddr = array[candidate];
+    recordEviction(candidate, wbLineValue);
+    profExtraEvictions.inc();
 
+    usedSegs[set] -= segs[candidate];
+    segs[candidate] = 0;
+    array[candidate] = 0;
+    rp->replaced(candidate);
     return candidate;
 }
 
-CompressedDataAwareSetAssoc::CompressedDataAwareSetAssoc(uint32_t _numLines, uint32_t _lineSize, uint32_t _assoc,
-                                                         ReplPolicy *_rp, HashFamily *_hf) : DataAwareSetAssocArray(
-        _numLines, _lineSize, _assoc, _rp, _hf) {}
+void CompressedDataAwareSetAssoc::postinsert(const Address lineAddr, const MemReq *req, uint32_t candidate) {
+    assert(candidate == insCandidate);
+    DataAwareSetAssocArray::postinsert(lineAddr, req, candidate);
+    uint32_t set = candidate / assoc;
+    usedSegs[set] += insSegs - segs[candidate];
+    segs[candidate] = insSegs;
+    assert(usedSegs[set] <= setSegs);
+
+    profInsertions.inc();
+    profInsertedSegs.inc(insSegs);
+    profSegsHist.inc(insSegs);
+}
 
+void CompressedDataAwareSetAssoc::updateValue(void *value, UINT32 size, unsigned int offset, uint32_t candidate,
+                                              Address pc, AccessType type) {
+    DataAwareSetAssocArray::updateValue(value, size, offset, candidate, pc, type);
+    uint32_t newSegs = compressedSegs(lineValue(candidate));
+    if (newSegs == segs[candidate]) return;
 
-//std::ofstream llcEvictionTrace("llcEvictionTrace.txt");
-//PIN_LOCK l;
+    uint32_t set = candidate / assoc;
+    usedSegs[set] += newSegs - segs[candidate];
+    if (newSegs > segs[candidate] && usedSegs[set] > setSegs) profOverflows.inc();
+    segs[candidate] = newSegs;
+}
 
-uint32_t CompressedDataAwareSetAssoc::preinsert(const Address lineAddr, const MemReq *req, Address *wbLineAddr,
-                                                char *wbLineValue) {
+void CompressedDataAwareSetAssoc::initStats(AggregateStat *parentStat) {
+    DataAwareSetAssocArray::initStats(parentStat);
 
-    return SetAssocArray::preinsert(lineAddr, req, wbLineAddr, wbLineValue);
+    AggregateStat *objStats = new AggregateStat();
+    objStats->init("compression", "Compressed array stats");
+    profInsertions.init("insertions", "Inserted lines");
+    objStats->append(&profInsertions);
+    profInsertedSegs.init("insertedSegs", "Data segments of inserted lines");
+    objStats->append(&profInsertedSegs);
+    profExtraEvictions.init("extraEvictions", "Lines replaced beyond the first to fit an inserted line");
+    objStats->append(&profExtraEvictions);
+    profOverflows.init("overflows", "Writes that grew a line past the free segments of its set");
+    objStats->append(&profOverflows);
+    profSegsHist.init("segsHist", "Inserted lines by number of data segments", segsPerLine + 1);
+    objStats->append(&profSegsHist);
+
+    // Snapshots of the resident lines. Ratios are in thousandths
+    auto residentLines = [this]() {
+        uint64_t lines = 0;
+        for (uint32_t id = 0; id < numLines; id++) lines += segs[id] ? 1 : 0;
+        return lines;
+    };
+    auto residentSegs = [this]() {
+        uint64_t used = 0;
+        for (uint32_t set = 0; set < numSets; set++) used += usedSegs[set];
+        return used;
+    };
+    auto linesStat = makeLambdaStat(residentLines);
+    linesStat->init("residentLines", "Lines holding data");
+    objStats->append(linesStat);
+    auto segsStat = makeLambdaStat(residentSegs);
+    segsStat->init("residentSegs", "Data segments in use");
+    objStats->append(segsStat);
+    auto ratio = [this, residentLines, residentSegs]() {
+        uint64_t used = residentSegs();
+        return used ? 1000 * residentLines() * segsPerLine / used : 0;
+    };
+    auto ratioStat = makeLambdaStat(ratio);
+    ratioStat->init("compressionRatio", "Uncompressed over compressed size of resident lines (x1000)");
+    objStats->append(ratioStat);
+    auto capacity = [this, residentLines]() {
+        return 1000 * residentLines() * segsPerLine / ((uint64_t) numSets * setSegs);
+    };
+    auto capacityStat = makeLambdaStat(capacity);
+    capacityStat->init("effectiveCapacity", "Resident lines over the lines the data array holds uncompressed (x1000)");
+    objStats->append(capacityStat);
 
-//    llc eviction
-//
-//    memcpy(wbLineValue, (char*) values[candidate], lineSize);
-//
-//    char* memValue = new char[lineSize];
-//    PIN_SafeCopy(memValue, (void*)(*wbLineAddr << lineBits), lineSize);
-//
-//    if(*wbLineAddr){
-//        bool equal = true;
-//
-//        PIN_GetLock(&l, 23);
-//        EmitMem(memValue, 64, 0);
-//        EmitMem(wbLineValue, 64, 0);
-//        saed << "-------------" << std::endl;
-//        for(unsigned int i = 0; i < lineSize; i++) {
-//            if(memValue[i] != wbLineValue[i]){
-//                equal = false;
-//            }
-//        }
-//
-//        if(!equal){
-//            llcEvictionTrace << "riidiiim  " << std::hex << " " << *wbLineAddr << std::endl;
-//        } else {
-//            llcEvictionTrace << "naridim   " << std::hex << " " << *wbLineAddr << std::endl;
-//        }
-//        PIN_ReleaseLock(&l);
-//    }
+    parentStat->append(objStats);
 }
@@ -26,6 +26,7 @@
 #ifndef CACHE_ARRAYS_H_
 #define CACHE_ARRAYS_H_
 
+#include <emmintrin.h>
 #include "memory_hierarchy.h"
 #include "stats.h"
 
@@ -49,15 +50,30 @@ public:
 
     virtual void postinsert(const Address lineAddr, const MemReq *req, uint32_t lineId) = 0;
 
+    /* Arrays that may need to replace more than one line to fit the new one (e.g., compressed arrays)
+     * return the additional lines one at a time between preinsert() and postinsert(), like preinsert();
+     * -1 once the new line fits. Returned lines are no longer in the array.
+     */
+    virtual int32_t preinsertExtra(const Address lineAddr, const MemReq *req, Address *wbLineAddr, char* wbLineValue) {
+        return -1;
+    }
+
     virtual void initStats(AggregateStat *parent) {}
 
-    virtual void updateValue(void* value, UINT32 size, unsigned int offset, uint32_t candidate) {};
+    // Writes value into the line; type is GETX for stores, PUTS/PUTX for writebacks from children
+    virtual void updateValue(void* value, UINT32 size, unsigned int offset, uint32_t candidate, Address pc,
+                             AccessType type) {};
+
+    /* False if the line is known to hold the value it was filled with, so evicting it needs no writeback */
+    virtual bool mayBeDirty(uint32_t lineId) { return true; }
 };
 
 class ReplPolicy;
 
 class HashFamily;
 
+struct ZWalkInfo;
+
 
 /* Set-associative cache array */
 class SetAssocArray : public CacheArray {
@@ -80,14 +96,86 @@ public:
     virtual void postinsert(const Address lineAddr, const MemReq *req, uint32_t candidate);
 };
 
+/* Contents of a line, in 8-byte words: which are zero and which were written since the line was inserted.
+ * Computed once per eviction (see DataAwareSetAssocArray::getLastEviction()), for stats and compression.
+ */
+struct LineSummary {
+    uint64_t zeroWords;  // bit i set if word i is zero
+    uint64_t dirtyWords;
+    uint32_t numWords;
+
+    uint32_t numZeroWords() const { return __builtin_popcountll(zeroWords); }
+    uint32_t numDirtyWords() const { return __builtin_popcountll(dirtyWords); }
+    uint32_t numDirtyZeroWords() const { return __builtin_popcountll(dirtyWords & zeroWords); }
+    bool isZero() const { return numZeroWords() == numWords; }
+    bool isDirty() const { return dirtyWords != 0; }
+
+    // numWords must be even (lines are multiples of 16 bytes), and value 16-byte aligned
+    static inline LineSummary classify(const char *value, uint32_t numWords, uint64_t dirtyWords) {
+        // SSE2 (we build for core2): compare 2 words per iteration to zero, 32 bits at a time; a word is zero
+        // if all 8 of its byte mask bits are set
+        const __m128i zero = _mm_setzero_si128();
+        uint64_t zeroWords = 0;
+        for (uint32_t w = 0; w < numWords; w += 2) {
+            __m128i v = _mm_load_si128(reinterpret_cast<const __m128i *>(value + w * 8));
+            uint32_t m = _mm_movemask_epi8(_mm_cmpeq_epi32(v, zero));
+            zeroWords |= (uint64_t) (((m & 0xff) == 0xff) | (((m >> 8) == 0xff) << 1)) << w;
+        }
+        return {zeroWords, dirtyWords, numWords};
+    }
+};
+
 class DataAwareSetAssocArray : public SetAssocArray{
 protected:
-    void **values;
-    bool **dirty;
+    char *values;  // line values, lineSize bytes per lineId, contiguous
+    uint64_t *dirty;  // per line, bit i set if word i was written since the line was inserted
     uint32_t lineSize;
     static const int word_bytes = 8;
     int* write_counts;
 
+    LineSummary lastEviction;  // set in preinsert()
+
+    // Silent stores: a store only dirties the words it changes, and lines with no changed words are evicted clean.
+    // Store PCs are profiled in a small direct-mapped table; a resident PC is replaced once conflicting PCs
+    // outnumber its hits
+    struct StorePC {
+        Address pc;
+        uint64_t stores;
+        uint64_t silent;
+        uint32_t conf;
+    };
+    bool silentStores;
+    StorePC *storePCs;
+    uint32_t numStorePCs;
+    Counter profStores;
+    Counter profSilentStores;
+
+    // Eviction stats. Like the arrays, these are protected by the cache bank lock
+    Counter profEvictions;
+    Counter profDirtyEvictions;
+    Counter profZeroEvictions;
+    Counter profDirtyWords;
+    Counter profDirtyLineZeroWords;
+    Counter profWrites;
+    VectorCounter profDirtyWordsHist;  // evicted lines by number of dirty words
+    VectorCounter profZeroWordsHist;
+
+    inline char *lineValue(uint32_t lineId) const { return values + (size_t) lineId * lineSize; }
+
+    // Words overlapped by a write of size bytes at offset
+    inline uint64_t writtenWords(uint32_t offset, uint32_t size) const {
+        uint32_t start_word = offset / word_bytes;
+        uint32_t writeSize = (size < lineSize - offset) ? size : lineSize - offset;
+        uint32_t end_word = (writeSize + offset - 1) / word_bytes;
+        // (2 << end_word) - 1 has bits 0..end_word set, and wraps around to all ones for end_word == 63
+        return ((2ul << end_word) - 1) & ~((1ul << start_word) - 1);
+    }
+
+    void profileStorePC(Address pc, bool silent);
+
+    // Copies out the value of a line being replaced, and updates lastEviction and the eviction stats
+    void recordEviction(uint32_t candidate, char *wbLineValue);
+
 public:
     DataAwareSetAssocArray(uint32_t _numLines, uint32_t _lineSize, uint32_t _assoc, ReplPolicy *_rp, HashFamily *_hf);
 
@@ -95,16 +183,72 @@ public:
 
     virtual uint32_t preinsert(const Address lineAddr, const MemReq *req, Address *wbLineAddr, char* wbLineValue) override;
 
-    virtual void updateValue(void* value, UINT32 size, unsigned int offset, uint32_t candidate) override;
+    virtual void updateValue(void* value, UINT32 size, unsigned int offset, uint32_t candidate, Address pc,
+                             AccessType type) override;
+
+    virtual bool mayBeDirty(uint32_t lineId) override { return !silentStores || dirty[lineId]; }
+
+    // Turns on silent store detection, profiling up to storePCEntries store PCs. Call before initStats()
+    void enableSilentStores(uint32_t storePCEntries);
+
+    // Contents of the line chosen by the last preinsert(). Allows intervening lookups
+    const LineSummary &getLastEviction() const { return lastEviction; }
+
+    virtual void initStats(AggregateStat *parentStat) override;
 };
 
+/* Compressed data-aware array with a decoupled tag store: each set has assoc tags, but only dataWays lines'
+ * worth of data, in segments of segmentBytes. Lines take as many segments as their compressed value needs,
+ * and an insertion replaces lines (in replacement policy order) until the new line fits. Segments of a set
+ * are compacted on every insertion, so only their count matters. Writes may grow a line past the free
+ * segments of its set; the set is brought back within its segments on its next insertion.
+ */
 class CompressedDataAwareSetAssoc : public DataAwareSetAssocArray{
 public:
-    CompressedDataAwareSetAssoc(uint32_t _numLines, uint32_t _lineSize, uint32_t _assoc, ReplPolicy *_rp,
-                                HashFamily *_hf);
+    enum Compressor {BDI, FPC, BEST};
+
+private:
+    Compressor compressor;
+    uint32_t segmentBytes;
+    uint32_t segsPerLine;
+    uint32_t setSegs;  // data segments per set
+    uint8_t *segs;  // per line, 0 if the tag is free
+    uint32_t *usedSegs;  // per set
+
+    // Insertion in progress, set in preinsert()
+    uint32_t insCandidate;
+    uint32_t insSegs;
+    ZWalkInfo *extraCands;  // assoc entries
+
+    Counter profInsertions;
+    Counter profInsertedSegs;
+    Counter profExtraEvictions;
+    Counter profOverflows;
+    VectorCounter profSegsHist;  // inserted lines by number of segments
+
+public:
+    CompressedDataAwareSetAssoc(uint32_t _numLines, uint32_t _lineSize, uint32_t _assoc, uint32_t _dataWays,
+                                uint32_t _segmentBytes, Compressor _compressor, ReplPolicy *_rp, HashFamily *_hf);
 
     virtual uint32_t
     preinsert(const Address lineAddr, const MemReq *req, Address *wbLineAddr, char *wbLineValue) override;
+
+    virtual int32_t
+    preinsertExtra(const Address lineAddr, const MemReq *req, Address *wbLineAddr, char *wbLineValue) override;
+
+    virtual void postinsert(const Address lineAddr, const MemReq *req, uint32_t candidate) override;
+
+    virtual void updateValue(void* value, UINT32 size, unsigned int offset, uint32_t candidate, Address pc,
+                             AccessType type) override;
+
+    virtual void initStats(AggregateStat *parentStat) override;
+
+    // Compressed sizes in bytes, at most lineSize
+    static uint32_t bdiSize(const char *value, uint32_t lineSize);
+    static uint32_t fpcSize(const char *value, uint32_t lineSize);
+
+private:
+    uint32_t compressedSegs(const char *value) const;
 };
 
 /* The cache array that started this simulator :) */
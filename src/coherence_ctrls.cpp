@@ -53,7 +53,7 @@ void MESIBottomCC::init(const g_vector<MemObject *> &_parents, Network *network,
 }
 
 
-uint64_t MESIBottomCC::processEviction(Address wbLineAddr, uint32_t lineId, bool lowerLevelWriteback,
+uint64_t MESIBottomCC::processEviction(Address wbLineAddr, uint32_t lineId, bool lowerLevelWriteback, bool valueDirty,
                                        uint64_t cycle, uint32_t srcId, Address pc /*Kasraa*/,
                                        void* value, UINT32 size, unsigned int line_offset, Address vLineAddr) {
     MESIState *state = &array[lineId];
@@ -61,6 +61,10 @@ uint64_t MESIBottomCC::processEviction(Address wbLineAddr, uint32_t lineId, bool
         //If this happens, when tcc issued the invalidations, it got a writeback. This means we have to do a PUTX, i.e. we have to transition to M if we are in E
         assert(*state == M || *state == E); //Must have exclusive permission!
         *state = M; //Silent E->M transition (at eviction); now we'll do a PUTX
+    } else if (*state == M && !valueDirty) {
+        //Every write to the line stored what it already held, so the parent's copy is up to date: M->E, and do a PUTS
+        *state = E;
+        profCleanPUTX.inc();
     }
     uint64_t respCycle = cycle;
     switch (*state) {
@@ -69,14 +73,14 @@ uint64_t MESIBottomCC::processEviction(Address wbLineAddr, uint32_t lineId, bool
         case S:
         case E: {
             MemReq req = {wbLineAddr, PUTS, selfId, state, cycle, &ccLock, *state, srcId, 0 /*no flags*/,
-                          pc /*Kasraa*/, value, size, line_offset, vLineAddr};
+                          pc /*Kasraa*/, MEMREQ_VALUE(value) size, line_offset, vLineAddr};
             //printf("[71] ID=%d, name=%s\n", getParentId(wbLineAddr), parents[getParentId(wbLineAddr)]->getName());
             respCycle = parents[getParentId(wbLineAddr)]->access(req);
         }
             break;
         case M: {
             MemReq req = {wbLineAddr, PUTX, selfId, state, cycle, &ccLock, *state, srcId, 0 /*no flags*/,
-                          pc /*Kasraa*/, value, size, line_offset, vLineAddr};
+                          pc /*Kasraa*/, MEMREQ_VALUE(value) size, line_offset, vLineAddr};
             //printf("[78] ID=%d, name=%s\n", getParentId(wbLineAddr), parents[getParentId(wbLineAddr)]->getName());
             respCycle = parents[getParentId(wbLineAddr)]->access(req);
         }
@@ -111,7 +115,7 @@ uint64_t MESIBottomCC::processAccess(Address lineAddr, uint32_t lineId, AccessTy
             if (*state == I) {
                 uint32_t parentId = getParentId(lineAddr);
                 //printf("[lines=%d, id=%d] parentId = %d/%ld, lineAddr=%#lx\n", numLines, selfId, parentId, parents.size(), lineAddr);
-                MemReq req = {lineAddr, GETS, selfId, state, cycle, &ccLock, *state, srcId, flags, pc /*Kasraa*/, value, size, line_offset, vLineAddr};
+                MemReq req = {lineAddr, GETS, selfId, state, cycle, &ccLock, *state, srcId, flags, pc /*Kasraa*/, MEMREQ_VALUE(value) size, line_offset, vLineAddr};
                 uint32_t nextLevelLat = parents[parentId]->access(req) - cycle;
                 uint32_t netLat = parentRTTs[parentId];
                 profGETNextLevelLat.inc(nextLevelLat);
@@ -129,7 +133,7 @@ uint64_t MESIBottomCC::processAccess(Address lineAddr, uint32_t lineId, AccessTy
                 if (*state == I) profGETXMissIM.inc();
                 else profGETXMissSM.inc();
                 uint32_t parentId = getParentId(lineAddr);
-                MemReq req = {lineAddr, GETX, selfId, state, cycle, &ccLock, *state, srcId, flags, pc /*Kasraa*/, value, size, line_offset, vLineAddr};
+                MemReq req = {lineAddr, GETX, selfId, state, cycle, &ccLock, *state, srcId, flags, pc /*Kasraa*/, MEMREQ_VALUE(value) size, line_offset, vLineAddr};
                 //printf("[130] ID=%d, name=%s\n", parentId, parents[parentId]->getName());
                 uint32_t nextLevelLat = parents[parentId]->access(req) - cycle;
                 uint32_t netLat = parentRTTs[parentId];
@@ -203,7 +207,7 @@ uint64_t MESIBottomCC::processNonInclusiveWriteback(Address lineAddr, AccessType
 
     //info("Non-inclusive wback, forwarding");
     MemReq req = {lineAddr, type, selfId, state, cycle, &ccLock, *state, srcId, flags | MemReq::NONINCLWB,
-                  pc /*Kasraa*/, value, size, line_offset, vLineAddr};
+                  pc /*Kasraa*/, MEMREQ_VALUE(value) size, line_offset, vLineAddr};
 
     //printf("[199] ID=%d, name=%s\n", getParentId(lineAddr), parents[getParentId(lineAddr)]->getName());
 
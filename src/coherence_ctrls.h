@@ -52,8 +52,9 @@ public:
     virtual bool startAccess(
             MemReq &req) = 0; //initial locking, address races; returns true if access should be skipped; may change req!
     virtual bool shouldAllocate(const MemReq &req) = 0; //called when we don't find req's lineAddr in the array
+    //called iff shouldAllocate returns true; valueDirty is false if the array knows the line matches its parent's copy
     virtual uint64_t processEviction(const MemReq &triggerReq, Address wbLineAddr, void *wbLineValue, int32_t lineId,
-                                     uint64_t startCycle) = 0; //called iff shouldAllocate returns true
+                                     uint64_t startCycle, bool valueDirty) = 0;
     virtual uint64_t
     processAccess(const MemReq &req, int32_t lineId, uint64_t startCycle, uint64_t *getDoneCycle = nullptr) = 0;
 
@@ -103,6 +104,7 @@ private:
     //Counter profWBIncl, profWBCoh /* writebacks due to inclusion or coherence, received from downstream, does not include PUTS */;
     // TODO: Measuring writebacks is messy, do if needed
     Counter profGETNextLevelLat, profGETNetLat;
+    Counter profCleanPUTX;  // dirty lines evicted as clean, see processEviction()
 
     bool nonInclusiveHack;
 
@@ -140,6 +142,7 @@ public:
         profFWD.init("FWD", "Forwards (from upper level)");
         profGETNextLevelLat.init("latGETnl", "GET request latency on next level");
         profGETNetLat.init("latGETnet", "GET request latency on network to next level");
+        profCleanPUTX.init("cleanPUTX", "Written lines evicted clean (PUTS), all writes were silent; saves a writeback");
 
         parentStat->append(&profGETSHit);
         parentStat->append(&profGETXHit);
@@ -153,11 +156,13 @@ public:
         parentStat->append(&profFWD);
         parentStat->append(&profGETNextLevelLat);
         parentStat->append(&profGETNetLat);
+        parentStat->append(&profCleanPUTX);
     }
 
     uint64_t
-    processEviction(Address wbLineAddr, uint32_t lineId, bool lowerLevelWriteback, uint64_t cycle, uint32_t srcId,
-                    Address pc /*Kasraa*/, void *value, UINT32 size, unsigned int line_offset, Address vLineAddr);
+    processEviction(Address wbLineAddr, uint32_t lineId, bool lowerLevelWriteback, bool valueDirty, uint64_t cycle,
+                    uint32_t srcId, Address pc /*Kasraa*/, void *value, UINT32 size, unsigned int line_offset,
+                    Address vLineAddr);
 
     uint64_t
     processAccess(Address lineAddr, uint32_t lineId, AccessType type, uint64_t cycle, uint32_t srcId, uint32_t flags,
@@ -362,14 +367,14 @@ public:
     }
 
     uint64_t processEviction(const MemReq &triggerReq, Address wbLineAddr, void *wbLineValue, int32_t lineId,
-                             uint64_t startCycle) {
+                             uint64_t startCycle, bool valueDirty) {
         bool lowerLevelWriteback = false;
         uint64_t evCycle = tcc->processEviction(wbLineAddr, lineId, &lowerLevelWriteback, startCycle, triggerReq.srcId,
                                                 triggerReq.pc /*Kasraa*/); //1. if needed, send invalidates/downgrades to lower level
 
         unsigned int lineSize = (1U << lineBits);
         // SMF : won't use vLineAddr so we pass zero as the last arg.
-        evCycle = bcc->processEviction(wbLineAddr, lineId, lowerLevelWriteback, evCycle, triggerReq.srcId,
+        evCycle = bcc->processEviction(wbLineAddr, lineId, lowerLevelWriteback, valueDirty, evCycle, triggerReq.srcId,
                                        triggerReq.pc /*Kasraa*/, wbLineValue, lineSize, 0, 0); //2. if needed, write back line to upper level
 
 
@@ -498,10 +503,11 @@ public:
     }
 
     uint64_t processEviction(const MemReq &triggerReq, Address wbLineAddr, void *wbLineValue, int32_t lineId,
-                             uint64_t startCycle) {
+                             uint64_t startCycle, bool valueDirty) {
         bool lowerLevelWriteback = false;
         unsigned int lineSize = (1U << lineBits);
-        uint64_t endCycle = bcc->processEviction(wbLineAddr, lineId, lowerLevelWriteback, startCycle, triggerReq.srcId,
+        uint64_t endCycle = bcc->processEviction(wbLineAddr, lineId, lowerLevelWriteback, valueDirty, startCycle,
+                                                 triggerReq.srcId,
                                                  triggerReq.pc /*Kasraa*/, wbLineValue, lineSize, 0, 0); //2. if needed, write back line to upper level
         return endCycle;  // critical path unaffected, but TimingCache needs it
     }
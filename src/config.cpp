@@ -25,6 +25,7 @@
 
 #include "config.h"
 #include <sstream>
+#include <stdlib.h>
 #include <string.h>
 #include <string>
 #include <typeinfo>
@@ -312,6 +313,49 @@ void Config::subgroups(const char *key, std::vector<const char *> &grps) {
 }
 
 
+template<typename T>
+static void setVar(libconfig::Config *cfg, const char *key, T val) {
+    if (cfg->exists(key)) cfg->lookup(key) = val;
+    else writeVar(cfg, key, val);
+}
+
+void Config::set(const char *key, const char *value) {
+    SType type;
+    char *end;
+    if (inCfg->exists(key)) {
+        type = inCfg->lookup(key).getType();
+    } else if (strcmp(value, "true") == 0 || strcmp(value, "false") == 0) {
+        type = SType::TypeBoolean;
+    } else {
+        lc_int64 iv = strtoll(value, &end, 0);
+        if (*value && !*end) {
+            type = (iv == (int) iv) ? SType::TypeInt : SType::TypeInt64;
+        } else {
+            strtod(value, &end);
+            type = (*value && !*end) ? SType::TypeFloat : SType::TypeString;
+        }
+    }
+
+    if (type == SType::TypeString) {
+        setVar<const char *>(inCfg, key, value);
+    } else if (type == SType::TypeBoolean) {
+        if (strcmp(value, "true") && strcmp(value, "false")) panic("Setting %s is a bool, cannot set it to %s", key, value);
+        setVar<bool>(inCfg, key, strcmp(value, "true") == 0);
+    } else if (type == SType::TypeFloat) {
+        double v = strtod(value, &end);
+        if (!*value || *end) panic("Setting %s is a double, cannot set it to %s", key, value);
+        setVar<double>(inCfg, key, v);
+    } else if (type == SType::TypeInt || type == SType::TypeInt64) {
+        lc_int64 v = strtoll(value, &end, 0);
+        if (!*value || *end) panic("Setting %s is an integer, cannot set it to %s", key, value);
+        if (type == SType::TypeInt) setVar<int>(inCfg, key, (int) v);
+        else setVar<lc_int64>(inCfg, key, v);
+    } else {
+        panic("Setting %s is a group or list, cannot set it to %s", key, value);
+    }
+}
+
+
 /* Config value parsing functions */
 
 //Range parsing, for process masks
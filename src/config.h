@@ -83,6 +83,10 @@ public:
 
     void subgroups(const std::string &key, std::vector<const char *> &grps) { subgroups(key.c_str(), grps); }
 
+    // Overrides (or adds) an input setting, e.g., from the command line. Existing settings keep their type;
+    // new ones are typed by parsing the value (bool, int, float, or string)
+    void set(const char *key, const char *value);
+
 private:
     template<typename T>
     T genericGet(const char *key);
@@ -35,6 +35,15 @@
 #define MAX_CACHE_CHILDREN (256)
 //#define MAX_CACHE_CHILDREN (1024)
 
+// Largest supported cache line. Caches keep the values of the lines they evict on the stack, so this bounds them.
+#define MAX_LINE_BYTES (256)
+
+// Line value tracking, for the data-aware cache arrays. Build with -DVALUE_TRACKING=0 to compile it out: requests
+// carry no value, cores capture nothing, caches update no values, and data-aware arrays are rejected at init.
+#ifndef VALUE_TRACKING
+#define VALUE_TRACKING (1)
+#endif
+
 // Complex multiprocess runs need multiple clocks, and multiple port domains
 #define MAX_CLOCK_DOMAINS (64)
 #define MAX_PORT_DOMAINS (64)
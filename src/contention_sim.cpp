@@ -25,7 +25,6 @@
 
 #include "contention_sim.h"
 #include <algorithm>
-#include <queue>
 #include <sstream>
 #include <string>
 #include <typeinfo>
@@ -45,12 +44,6 @@ bool ContentionSim::CompareEvents::operator()(TimingEvent *lhs, TimingEvent *rhs
     return lhs->cycle > rhs->cycle;
 }
 
-bool ContentionSim::CompareDomains::operator()(DomainData *d1, DomainData *d2) const {
-    uint64_t v1 = d1->queuePrio;
-    uint64_t v2 = d2->queuePrio;
-    return (v1 > v2);
-}
-
 
 void ContentionSim::SimThreadTrampoline(void *arg) {
     ContentionSim *csim = static_cast<ContentionSim *>(arg);
@@ -58,10 +51,12 @@ void ContentionSim::SimThreadTrampoline(void *arg) {
     csim->simThreadLoop(thid);
 }
 
-ContentionSim::ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads) {
+ContentionSim::ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads, uint64_t _sliceCycles) {
     numDomains = _numDomains;
     numSimThreads = _numSimThreads;
+    sliceCycles = _sliceCycles;
     threadsDone = 0;
+    domainsDone = 0;
     limit = 0;
     lastLimit = 0;
     inCSim = false;
@@ -73,16 +68,17 @@ ContentionSim::ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads) {
         new(&domains[i].pq) PrioQueue<TimingEvent, PQ_BLOCKS>();
         domains[i].curCycle = 0;
         futex_init(&domains[i].pqLock);
+        domains[i].homeThread = i % numSimThreads;
     }
 
-    if ((numDomains % numSimThreads) != 0) panic("numDomains(%d) must be a multiple of numSimThreads(%d) for now",
-                                                 numDomains, numSimThreads);
+    if (numSimThreads == 0) panic("Need at least one contention simulation thread");
+    if (sliceCycles == 0) panic("Contention simulation slices must be at least one cycle");
+    if (numSimThreads > numDomains) warn("%d contention simulation threads for %d domains, %d will only steal",
+                                         numSimThreads, numDomains, numSimThreads - numDomains);
 
     for (uint32_t i = 0; i < numSimThreads; i++) {
         futex_init(&simThreads[i].wakeLock);
         futex_lock(&simThreads[i].wakeLock); //starts locked, so first actual call to lock blocks
-        simThreads[i].firstDomain = i * numDomains / numSimThreads;
-        simThreads[i].supDomain = (i + 1) * numDomains / numSimThreads;
     }
 
     futex_init(&waitLock);
@@ -100,6 +96,11 @@ ContentionSim::ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads) {
 
     lastCrossing = gm_calloc<CrossingEventInfo>(
             numDomains * numDomains * MAX_THREADS); //TODO: refine... this allocs too much
+
+    numSources = zinfo->numCores;
+    crossingStride = (numDomains + 7) & ~7;
+    pendingCrossings = gm_memalign<TimingEvent *>(CACHE_LINE_BYTES, numSources * crossingStride);
+    memset(pendingCrossings, 0, numSources * crossingStride * sizeof(TimingEvent *));
 }
 
 void ContentionSim::postInit() {
@@ -142,6 +143,25 @@ void ContentionSim::initStats(AggregateStat *parentStat) {
         domStat->append(&domains[i].profTime);
         objStat->append(domStat);
     }
+    const char *stateNames[] = {"sleep", "busy", "idle"};
+    for (uint32_t i = 0; i < numSimThreads; i++) {
+        std::stringstream ss;
+        ss << "thread-" << i;
+        AggregateStat *thStat = new AggregateStat();
+        thStat->init(gm_strdup(ss.str().c_str()), "Weave thread stats");
+        SimThreadData &th = simThreads[i];
+        new(&th.profState) TimeBreakdownStat();
+        th.profState.init("time", "Weave thread time (ns) sleeping between phases, running domains, and waiting for "
+                          "a domain to run", SIM_NUM_STATES, stateNames);
+        new(&th.profSlices) Counter();
+        th.profSlices.init("slices", "Domain slices simulated");
+        new(&th.profSteals) Counter();
+        th.profSteals.init("steals", "Slices of domains homed in other threads");
+        thStat->append(&th.profState);
+        thStat->append(&th.profSlices);
+        thStat->append(&th.profSteals);
+        objStat->append(thStat);
+    }
     parentStat->append(objStat);
 }
 
@@ -159,6 +179,13 @@ void ContentionSim::simulatePhase(uint64_t limit) {
         if (ocore) ocore->cSimStart();
     }
 
+    for (uint32_t i = 0; i < numDomains; i++) {
+        domains[i].claimed = false;
+        domains[i].finished = false;
+        domains[i].drained = false;
+    }
+    domainsDone = 0;
+
     inCSim = true;
     __sync_synchronize();
 
@@ -250,10 +277,19 @@ void ContentionSim::enqueueCrossing(CrossingEvent *ev, uint64_t cycle, uint32_t
             assert_msg(last->cycle <= cycle, "last->cycle (%ld) > cycle (%ld)", last->cycle, cycle);
             last->ev->addChild(ev, evRec);
         } else {
-            //We can't queue --- queue directly (synced, we're in phase 1)
+            //We can't chain --- hand it to the destination domain, which drains it in the weave phase
             assert(cycle >= srcDomCycle);
             //info("Queuing xing %ld %ld (lst eve too old at cycle %ld)", cycle, srcDomCycle, last->cycle);
-            enqueueSynced(ev, cycle);
+            assert(!inCSim);
+            assert(srcId < numSources);
+            assert_msg(cycle >= lastLimit, "Enqueued crossing before last limit! cycle %ld min %ld", cycle, lastLimit);
+            assert_msg(cycle < lastLimit + 10 * zinfo->phaseLength + 10000,
+                       "Queued crossing too far into the future, cycle %ld lastLimit %ld", cycle, lastLimit);
+            assert(ev->numParents == 0);
+            TimingEvent *&head = pendingCrossings[srcId * crossingStride + dstDomain];
+            ev->privCycle = cycle;
+            ev->next = head;
+            head = ev;
         }
         //Store this one as the last req
         last->cycle = cycle;
@@ -285,6 +321,7 @@ void ContentionSim::simThreadLoop(uint32_t thid) {
         //info("%d --- phase start", domain);
         simulatePhaseThread(thid);
         //info("%d --- phase end", domain);
+        simThreads[thid].profState.transition(SIM_SLEEP);
 
         uint32_t val = __sync_add_and_fetch(&threadsDone, 1);
         if (val == numSimThreads) {
@@ -295,126 +332,129 @@ void ContentionSim::simThreadLoop(uint32_t thid) {
     info("Finished contention simulation thread %d", thid);
 }
 
-void ContentionSim::simulatePhaseThread(uint32_t thid) {
-    uint32_t thDomains = simThreads[thid].supDomain - simThreads[thid].firstDomain;
-    uint32_t numFinished = 0;
-    //printf("thDomains = %d\n", thDomains);
-    if (thDomains == 1) {
-        DomainData &domain = domains[simThreads[thid].firstDomain];
-        domain.profTime.start();
-        PrioQueue<TimingEvent, PQ_BLOCKS> &pq = domain.pq;
-        while (pq.size() && pq.firstCycle() < limit) {
-            uint64_t domCycle = domain.curCycle;
-            uint64_t cycle;
-            TimingEvent *te = pq.dequeue(cycle);
-            //printf("cycle=%ld, domain=%d, numChild=%d, preDelay=%d, postDelay=%d, minStart=%ld\n",
-            //	cycle, te->getDomain(), te->getNumChildren(), te->getPreDelay(), te->getPostDelay(),
-            //	te->getMinStartCycle());
-            assert(cycle >= domCycle);
-            if (cycle != domCycle) {
-                domCycle = cycle;
-                domain.curCycle = cycle;
-            }
-            te->run(cycle);
-            uint64_t newCycle = pq.size() ? pq.firstCycle() : limit;
-            assert(newCycle >= domCycle);
-            if (newCycle != domCycle) domain.curCycle = newCycle;
-#if POST_MORTEM
-            simThreads[thid].logVec.push_back(std::make_pair(cycle, te));
-#endif
+ContentionSim::DomainData *ContentionSim::claimDomain(uint32_t thid) {
+    // Runnable home domains, then runnable domains of other threads, then stalled ones; by lowest curCycle.
+    // These reads race with other threads, but only pick the candidate; claiming it is atomic.
+    DomainData *best = nullptr;
+    uint32_t bestClass = 4;
+    uint64_t bestCycle = 0;
+    for (uint32_t i = 0; i < numDomains; i++) {
+        DomainData &d = domains[i];
+        if (d.claimed || d.finished) continue;
+        uint32_t cls = ((d.prio != 0) << 1) | (d.homeThread != thid);
+        uint64_t cycle = d.curCycle;
+        if (cls < bestClass || (cls == bestClass && cycle < bestCycle)) {
+            best = &d;
+            bestClass = cls;
+            bestCycle = cycle;
         }
-        domain.curCycle = limit;
-        domain.profTime.end();
+    }
+    if (!best || !__sync_bool_compare_and_swap(&best->claimed, false, true)) return nullptr;
+    if (best->finished) { //finished and released between our reads and the claim
+        best->claimed = false;
+        return nullptr;
+    }
+    return best;
+}
 
-#if POST_MORTEM
-        //Post-mortem
-        if (limit % 10000000 == 0)  {
-            futex_lock(&postMortemLock); //serialize output
-            uint32_t uniqueEvs = 0;
-            std::unordered_map<TimingEvent*, std::string> evsSeen;
-            for (std::pair<uint64_t, TimingEvent*> p : simThreads[thid].logVec) {
-                uint64_t cycle = p.first;
-                TimingEvent* te = p.second;
-                std::string desc = evsSeen[te];
-                if (desc == "") { //non-existnt
-                    std::stringstream ss;
-                    ss << uniqueEvs << " " << typeid(*te).name();
-                    CrossingEvent* ce = dynamic_cast<CrossingEvent*>(te);
-                    if (ce) {
-                        ss << " slack " << (ce->preSlack + ce->postSlack) << " osc " << ce->origStartCycle << " cnt " << ce->simCount;
-                    }
-
-                    evsSeen[te] = ss.str();
-                    uniqueEvs++;
-                    desc = ss.str();
-                }
-                info("[%d] %ld %s", thid, cycle, desc.c_str());
-            }
-            futex_unlock(&postMortemLock);
+void ContentionSim::drainCrossings(uint32_t dstDomain) {
+    PrioQueue<TimingEvent, PQ_BLOCKS> &pq = domains[dstDomain].pq;
+    for (uint32_t s = 0; s < numSources; s++) {
+        TimingEvent *&head = pendingCrossings[s * crossingStride + dstDomain];
+        TimingEvent *ev = head;
+        head = nullptr;
+        while (ev) {
+            TimingEvent *next = ev->next;
+            ev->next = nullptr;
+            pq.enqueue(ev, ev->privCycle);
+            ev = next;
         }
-        simThreads[thid].logVec.clear();
-#endif
+    }
+}
 
-    } else {
-        //info("XXX %d / %d %d %d", thid, thDomains, simThreads[thid].supDomain, simThreads[thid].firstDomain);
+void ContentionSim::simulateSlice(uint32_t thid, DomainData *domain) {
+    domain->profTime.start();
+    if (!domain->drained) {
+        drainCrossings(domain - domains);
+        domain->drained = true;
+    }
+    PrioQueue<TimingEvent, PQ_BLOCKS> &pq = domain->pq;
+    uint64_t sliceLimit = pq.size() ? MIN(limit, pq.firstCycle() + sliceCycles) : limit;
+    while (pq.size() && pq.firstCycle() < sliceLimit) {
+        uint64_t cycle;
+        TimingEvent *te = pq.dequeue(cycle);
+        assert(cycle >= domain->curCycle);
+        if (cycle != domain->curCycle) domain->curCycle = cycle;
+        bool stalled = domain->prio != 0;
+        if (!stalled) {
+            te->run(cycle);
+        } else {
+            te->state = EV_RUNNING;
+            te->simulate(cycle);
+        }
+        uint64_t newCycle = pq.size() ? pq.firstCycle() : limit;
+        assert(newCycle >= domain->curCycle);
+        if (newCycle != domain->curCycle) domain->curCycle = MIN(newCycle, limit);
+#if POST_MORTEM
+        simThreads[thid].logVec.push_back(std::make_pair(cycle, te));
+#endif
+        // A crossing is waiting for its source; let this or another thread run other domains meanwhile
+        if (domain->prio != 0) break;
+    }
+    if (!pq.size() || pq.firstCycle() >= limit) {
+        domain->curCycle = limit;
+        domain->finished = true;
+        __sync_fetch_and_add(&domainsDone, 1);
+    }
+    domain->profTime.end();
+}
 
-        std::priority_queue<DomainData *, std::vector<DomainData *>, CompareDomains> domPq;
-        for (uint32_t i = simThreads[thid].firstDomain; i < simThreads[thid].supDomain; i++) {
-            domPq.push(&domains[i]);
+void ContentionSim::simulatePhaseThread(uint32_t thid) {
+    SimThreadData &th = simThreads[thid];
+    th.profState.transition(SIM_IDLE);
+    while (domainsDone < numDomains) {
+        DomainData *domain = claimDomain(thid);
+        if (!domain) {
+            _mm_pause();
+            continue;
         }
+        th.profState.transition(SIM_BUSY);
+        th.profSlices.inc();
+        if (domain->homeThread != thid) th.profSteals.inc();
+        simulateSlice(thid, domain);
+        __sync_synchronize(); //publish the domain's state before releasing it
+        domain->claimed = false;
+        th.profState.transition(SIM_IDLE);
+    }
 
-        std::vector<DomainData *> sq1;
-        std::vector<DomainData *> sq2;
-
-        std::vector<DomainData *> &stalledQueue = sq1;
-        std::vector<DomainData *> &nextStalledQueue = sq2;
-
-        while (numFinished < thDomains) {
-            while (domPq.size()) {
-                DomainData *domain = domPq.top();
-                domPq.pop();
-                PrioQueue<TimingEvent, PQ_BLOCKS> &pq = domain->pq;
-                if (!pq.size() || pq.firstCycle() > limit) {
-                    numFinished++;
-                    domain->curCycle = limit;
-                } else {
-                    //info("YYY %d %ld %ld %d", numFinished, domPq.size(), domain->curCycle, domain->prio);
-                    uint64_t cycle;
-                    TimingEvent *te = pq.dequeue(cycle);
-                    //uint64_t nextCycle = pq.size()? pq.firstCycle() : cycle;
-                    if (cycle != domain->curCycle) domain->curCycle = cycle;
-                    te->run(cycle);
-                    domain->curCycle = pq.size() ? pq.firstCycle() : limit;
-                    domain->queuePrio = domain->curCycle;
-                    if (domain->prio == 0) domPq.push(domain);
-                    else stalledQueue.push_back(domain);
+#if POST_MORTEM
+    //Post-mortem
+    if (limit % 10000000 == 0)  {
+        futex_lock(&postMortemLock); //serialize output
+        uint32_t uniqueEvs = 0;
+        std::unordered_map<TimingEvent*, std::string> evsSeen;
+        for (std::pair<uint64_t, TimingEvent*> p : th.logVec) {
+            uint64_t cycle = p.first;
+            TimingEvent* te = p.second;
+            std::string desc = evsSeen[te];
+            if (desc == "") { //non-existnt
+                std::stringstream ss;
+                ss << uniqueEvs << " " << typeid(*te).name();
+                CrossingEvent* ce = dynamic_cast<CrossingEvent*>(te);
+                if (ce) {
+                    ss << " slack " << (ce->preSlack + ce->postSlack) << " osc " << ce->origStartCycle << " cnt " << ce->simCount;
                 }
-            }
 
-            while (stalledQueue.size()) {
-                DomainData *domain = stalledQueue.back();
-                stalledQueue.pop_back();
-                PrioQueue<TimingEvent, PQ_BLOCKS> &pq = domain->pq;
-                if (!pq.size() || pq.firstCycle() > limit) {
-                    numFinished++;
-                    domain->curCycle = limit;
-                } else {
-                    //info("SSS %d %ld %ld", numFinished, stalledQueue.size(), domain->curCycle);
-                    uint64_t cycle;
-                    TimingEvent *te = pq.dequeue(cycle);
-                    if (cycle != domain->curCycle) domain->curCycle = cycle;
-                    te->state = EV_RUNNING;
-                    te->simulate(cycle);
-                    domain->curCycle = pq.size() ? pq.firstCycle() : limit;
-                    domain->queuePrio = domain->curCycle;
-                    if (domain->prio == 0) domPq.push(domain);
-                    else nextStalledQueue.push_back(domain);
-                }
-                if (domPq.size()) break;
+                evsSeen[te] = ss.str();
+                uniqueEvs++;
+                desc = ss.str();
             }
-            if (!stalledQueue.size()) std::swap(stalledQueue, nextStalledQueue);
+            info("[%d] %ld %s", thid, cycle, desc.c_str());
         }
+        futex_unlock(&postMortemLock);
     }
+    th.logVec.clear();
+#endif
 
     //info("Phase done");
     __sync_synchronize();
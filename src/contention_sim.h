@@ -64,6 +64,15 @@ private:
 
     CrossingEventInfo *lastCrossing; //indexed by [srcId*doms*doms + srcDom*doms + dstDom]
 
+    /* Crossings that could not be chained in the bound phase, one intrusive list (over TimingEvent::next, with
+     * the cycle in privCycle) per (source, destination domain). Each source only produces events from one
+     * thread at a time, so these need no lock; each destination domain drains its lists when it is first
+     * simulated in the weave phase.
+     */
+    TimingEvent **pendingCrossings; //indexed by [srcId*crossingStride + dstDom]
+    uint32_t numSources;
+    uint32_t crossingStride; //rounded up to whole cache lines, so that sources do not share lines
+
     struct DomainData : public GlobAlloc {
         PrioQueue<TimingEvent, PQ_BLOCKS> pq;
 
@@ -73,8 +82,11 @@ private:
         lock_t pqLock; //used on phase 1 enqueues
         //lock_t domainLock; //used by simulation thread
 
-        uint32_t prio;
-        uint64_t queuePrio;
+        volatile uint32_t prio;
+        volatile bool claimed; //a sim thread is running a slice of this domain; only it touches pq
+        volatile bool finished; //no events left before the limit in this phase
+        bool drained; //pending crossings moved to pq in this phase
+        uint32_t homeThread;
 
         PAD();
 
@@ -87,16 +99,24 @@ private:
 #endif
     };
 
-    struct CompareDomains : public std::binary_function<DomainData *, DomainData *, bool> {
-        bool operator()(DomainData *d1, DomainData *d2) const;
-    };
+    /* Domains are simulated in slices of up to sliceCycles, or until they stall on a crossing. Each sim thread
+     * has a set of home domains (round-robin), and after each slice claims the most urgent unclaimed domain:
+     * runnable home domains first, then runnable domains of other threads (steals), then stalled domains, all by
+     * lowest curCycle. So threads whose domains finish early help the busiest domains, and a thread stalled on
+     * a crossing can run its source domain.
+     */
+    enum SimThreadState {SIM_SLEEP, SIM_BUSY, SIM_IDLE, SIM_NUM_STATES};
 
     struct SimThreadData {
         lock_t wakeLock; //used to sleep/wake up simulation thread
-        uint32_t firstDomain;
-        uint32_t supDomain; //supreme, ie first not included
 
         std::vector<std::pair<uint64_t, TimingEvent *> > logVec;
+
+        TimeBreakdownStat profState; //ns sleeping between phases, running slices, and spinning for a domain
+        Counter profSlices;
+        Counter profSteals; //slices of other threads' home domains
+
+        PAD();
     };
 
     //RO
@@ -107,6 +127,7 @@ private:
 
     uint32_t numDomains;
     uint32_t numSimThreads;
+    uint64_t sliceCycles;
     bool skipContention;
 
     PAD();
@@ -118,6 +139,7 @@ private:
     volatile bool terminate;
 
     volatile uint32_t threadsDone;
+    volatile uint32_t domainsDone; //finished domains in this phase
     volatile uint32_t threadTicket; //used only at init
 
     volatile bool inCSim; //true when inside contention simulation
@@ -128,7 +150,7 @@ private:
     lock_t postMortemLock;
 
 public:
-    ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads);
+    ContentionSim(uint32_t _numDomains, uint32_t _numSimThreads, uint64_t _sliceCycles);
 
     void initStats(AggregateStat *parentStat);
 
@@ -156,6 +178,12 @@ public:
 
     void setPrio(uint32_t domain, uint32_t prio) { domains[domain].prio = prio; }
 
+    //Must be called before any events are enqueued
+    void setFarQueueMode(uint32_t domain, PQFarMode mode) {
+        assert(domain < numDomains);
+        domains[domain].pq.setFarMode(mode);
+    }
+
 #if PROFILE_CROSSINGS
     void profileCrossing(uint32_t srcDomain, uint32_t dstDomain, uint32_t count) {
         domains[dstDomain].profIncomingCrossings.inc(srcDomain);
@@ -169,6 +197,12 @@ private:
 
     void simulatePhaseThread(uint32_t thid);
 
+    DomainData *claimDomain(uint32_t thid);
+
+    void simulateSlice(uint32_t thid, DomainData *domain);
+
+    void drainCrossings(uint32_t dstDomain);
+
     static void SimThreadTrampoline(void *arg);
 };
 
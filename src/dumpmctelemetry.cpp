@@ -0,0 +1,39 @@
+/* Simple program to print a MemoryController telemetry file as TSV, one row
+ * per record with the deltas since the previous record (so rows are per
+ * interval): cycle, requests, hit rate, mcdram and ext dram bytes,
+ * placements, clean and dirty evictions, the bandwidth balancing index and
+ * target (as fractions of the sets), and tag buffer occupancy.
+ */
+
+#include <stdio.h>
+
+#include "galloc.h"
+#include "mc_telemetry.h"
+
+int main(int argc, const char *argv[]) {
+    InitLog(""); //no log header
+    if (argc != 2) {
+        info("Prints a MemoryController telemetry file as per-interval TSV");
+        info("Usage: %s <telemetry>", argv[0]);
+        exit(1);
+    }
+
+    MCTelemetryReader tr(argv[1]);
+    double sets = tr.getNumSets() ? tr.getNumSets() : 1;
+
+    printf("cycle\trequests\thitRate\tmcdramBytes\textBytes\tplacements\tcleanEvict\tdirtyEvict\tdsIndex\tdsTarget"
+           "\ttagBufferOcc\n");
+    PackedMCTelemetryRecord prev = {};
+    for (const PackedMCTelemetryRecord *r = tr.begin(); r != tr.end(); r++) {
+        uint64_t hits = r->hits - prev.hits;
+        uint64_t accesses = hits + r->misses - prev.misses;
+        printf("%lu\t%lu\t%.4f\t%lu\t%lu\t%lu\t%lu\t%lu\t%.4f\t%.4f\t%.4f\n", r->cycle, r->requests - prev.requests,
+               accesses ? 1.0 * hits / accesses : 0.0, 16 * (r->mcdramBursts - prev.mcdramBursts),
+               16 * (r->extBursts - prev.extBursts), r->placements - prev.placements,
+               r->cleanEvictions - prev.cleanEvictions, r->dirtyEvictions - prev.dirtyEvictions, r->dsIndex / sets,
+               r->dsTarget / sets, r->tagBufferOccupancy / 1e6);
+        prev = *r;
+    }
+
+    return 0;
+}
@@ -0,0 +1,32 @@
+/* Simple program to decode a MemoryController trace back into TSV
+ * (pc, lineAddr, dirty, srcId, and optionally the request cycle)
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "galloc.h"
+#include "mc_tracing.h"
+
+int main(int argc, const char *argv[]) {
+    InitLog(""); //no log header
+    bool cycles = (argc == 3 && strcmp(argv[1], "-c") == 0);
+    if (argc != 2 && !cycles) {
+        info("Prints a MemoryController trace as pc/lineAddr/dirty/srcId TSV");
+        info("Usage: %s [-c] <trace>   (-c appends the request cycle)", argv[0]);
+        exit(1);
+    }
+
+    MCTraceReader tr(argv[argc - 1]);
+
+    // Large stdio buffer, the output is usually much bigger than the trace
+    static char outBuf[1 << 20];
+    setvbuf(stdout, outBuf, _IOFBF, sizeof(outBuf));
+    for (const PackedMCTraceRecord *r = tr.begin(); r != tr.end(); r++) {
+        if (cycles) printf("%lu\t%lu\t%d\t%d\t%lu\n", r->pc, r->lineAddr, r->dirty, r->srcId, r->cycle);
+        else printf("%lu\t%lu\t%d\t%d\n", r->pc, r->lineAddr, r->dirty, r->srcId);
+    }
+    fflush(stdout);
+
+    return 0;
+}
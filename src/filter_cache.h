@@ -50,11 +50,13 @@ private:
         volatile Address rdAddr;
         volatile Address wrAddr;
         volatile uint64_t availCycle;
+        uint32_t lineId;  // of wrAddr in the array; only used with filterLock held
 
         void clear() {
             wrAddr = 0;
             rdAddr = 0;
             availCycle = 0;
+            lineId = 0;
         }
     };
 
@@ -128,28 +130,37 @@ public:
         unsigned int offset = (unsigned int) (vAddr & ((1 << lineBits) - 1));
         Address vLineAddr = vAddr >> lineBits;
         uint32_t idx = vLineAddr & setMask;
-
-//         SMF: technically can't use filtercache anymore. values has to be updated.
-
-//        uint64_t availCycle = filterArray[idx].availCycle; //read before, careful with ordering to avoid timing races
-
-//        if (vLineAddr == filterArray[idx].wrAddr) {
-//            fGETXHit++;
+        uint64_t availCycle = filterArray[idx].availCycle; //read before, careful with ordering to avoid timing races
+        // With the TLB, lines of an array set do not share a filter entry, so an entry may outlive its line
+        if (vLineAddr == filterArray[idx].wrAddr && !_enable_tlb) {
             //NOTE: Stores don't modify availCycle; we'll catch matches in the core
             //filterArray[idx].availCycle = curCycle; //do optimistic store-load forwarding
-//        }
+            if (!zinfo->dataAwareCaches) {
+                fGETXHit++;
+                return MAX(curCycle, availCycle);
+            }
 
-        // SMF : bypassing the filter cache to store the values in the arrays.
+            // Data-aware arrays need the stored value. The line is ours (M or E) as long as the entry
+            // holds it, and invalidations clear the entry with filterLock held, so write it in place
+            futex_lock(&filterLock);
+            if (vLineAddr == filterArray[idx].wrAddr) {
+                array->updateValue(value, size, offset, filterArray[idx].lineId, pc, GETX);
+                fGETXHit++;
+                futex_unlock(&filterLock);
+                return MAX(curCycle, availCycle);
+            }
+            futex_unlock(&filterLock);  // lost it in the meantime
+        }
         return replace(vLineAddr, idx, false, curCycle, pc /*Kasraa*/, value, size, offset);
     }
 
     uint64_t replace(Address vLineAddr, uint32_t idx, bool isLoad, uint64_t curCycle, Address pc /*Kasraa*/, void* value, UINT32 size, unsigned int offset){
         Address pLineAddr;
+        futex_lock(&filterLock);
         // page num = vLineAddr shifted by 6 bits. So it is shifted by 12 bits in total (4KB page size)
         if (_enable_tlb) {
             Address vpgnum = vLineAddr >> 6;
             uint64_t pgnum;
-            futex_lock(&filterLock);
             if (_tlb.find(vpgnum) == _tlb.end()) {
                 do {
                     int64_t rand;
@@ -167,7 +178,7 @@ public:
         MESIState dummyState = MESIState::I;
 
         MemReq req = {pLineAddr, isLoad ? GETS : GETX, 0, &dummyState, curCycle, &filterLock, dummyState, srcId,
-                      reqFlags, pc, value, size, offset, vLineAddr};
+                      reqFlags, pc, MEMREQ_VALUE(value) size, offset, vLineAddr};
 
         uint64_t respCycle = access(req);
 
@@ -177,6 +188,7 @@ public:
         Address oldAddr = filterArray[idx].rdAddr;
         filterArray[idx].wrAddr = isLoad ? -1L : vLineAddr;
         filterArray[idx].rdAddr = vLineAddr;
+        if (!isLoad && zinfo->dataAwareCaches) filterArray[idx].lineId = array->lookup(req.lineAddr, &req, false);
 
         //For LSU simulation purposes, loads bypass stores even to the same line if there is no conflict,
         //(e.g., st to x, ld from x+8) and we implement store-load forwarding at the core.
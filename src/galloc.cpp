@@ -24,6 +24,7 @@
  */
 
 #include "galloc.h"
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -50,61 +51,170 @@
  */
 #define GM_BASE_ADDR ((const void*)0x00ABBA000000)
 
+/* The heap spans up to GM_MAX_SEGMENTS segments of the same size, at fixed
+ * addresses GM_SEGMENT_STRIDE apart from the base, each managed by its own
+ * mspace. All segments are created (and attached by every process) up front,
+ * but the heap only grows into the next one when the active ones are full;
+ * extra segments are created with SHM_NORESERVE (unless backed by huge
+ * pages), so they take no memory until then. Segment 0 starts with the
+ * gm_segment header.
+ */
+#define GM_MAX_SEGMENTS 16
+#define GM_SEGMENT_STRIDE (1ul << 36)  // 64 GB, the largest segment
+#define GM_HEADER_BYTES 1024
+#define GM_HUGE_PAGE_BYTES (2ul << 20)
+
+/* Thread caches. Small blocks (up to GM_CACHE_CLASSES * GM_CACHE_GRANULE
+ * bytes) are served from per-shard free lists, one per size class, which are
+ * refilled from and drained to the mspace GM_CACHE_BATCH blocks at a time, so
+ * most allocations and frees do not touch the heap lock.
+ *
+ * Pin tools cannot rely on OS thread-local storage, so each thread picks its
+ * shard by hashing its stack address. Shards are locked, but the lock is
+ * uncontended unless two threads' stacks hash to the same shard (and a thread
+ * that finds its shard busy just goes to the mspace). Shards live in the
+ * segment, and blocks keep their dlmalloc headers while cached, so any
+ * process can free any block, and frees find the size class from the header.
+ */
+#define GM_CACHE_SHARDS 64
+#define GM_CACHE_GRANULE 16
+#define GM_CACHE_CLASSES 32
+#define GM_CACHE_MAX_BYTES (GM_CACHE_CLASSES * GM_CACHE_GRANULE)
+#define GM_CACHE_BATCH 16
+
+struct gm_cache_shard {
+    lock_t lock;
+    uint32_t counts[GM_CACHE_CLASSES];
+    void *heads[GM_CACHE_CLASSES];  // free blocks, linked through their first word
+} ATTR_LINE_ALIGNED;
+
 struct gm_segment {
     volatile void *base_regp; //common data structure, accessible with glob_ptr; threads poll on gm_isready to determine when everything has been initialized
     volatile void *secondary_regp; //secondary data structure, used to exchange information between harness and initializing process
-    mspace mspace_ptr;
+    gm_cache_shard *shards;
+
+    size_t segmentSize;
+    uint32_t flags;
+    uint32_t numSegments;  // created and attached by all processes
+    volatile uint32_t activeSegments;  // those with an mspace, the rest are untouched; protected by lock
+    int shmids[GM_MAX_SEGMENTS];
+    mspace mspaces[GM_MAX_SEGMENTS];
 
     PAD();
     lock_t lock;
     PAD();
 };
 
+static_assert(sizeof(gm_segment) <= GM_HEADER_BYTES, "gm_segment header does not fit");
+
 static gm_segment *GM = nullptr;
 static int gm_shmid = 0;
 
-/* Heap segment size, in bytes. Can't grow for now, so choose something sensible, and within the machine's limits (see sysctl vars kernel.shmmax and kernel.shmall) */
-int gm_init(size_t segmentSize) {
-    /* Create a SysV IPC shared memory segment, attach to it, and mark the segment to
-     * auto-destroy when the number of attached processes becomes 0.
-     *
-     * IMPORTANT: There is a small window of vulnerability between shmget and shmctl that
-     * can lead to major issues: between these calls, we have a segment of persistent
-     * memory that will survive the program if it dies (e.g. someone just happens to send us
-     * a SIGKILL)
-     */
+static inline void *gm_segment_base(uint32_t idx) {
+    return (void *) ((uintptr_t) GM_BASE_ADDR + idx * GM_SEGMENT_STRIDE);
+}
 
-    assert(GM == nullptr);
-    assert(gm_shmid == 0);
-    gm_shmid = shmget(IPC_PRIVATE, segmentSize, 0644 | IPC_CREAT /*| SHM_HUGETLB*/);
-    if (gm_shmid == -1) {
-        perror("gm_create failed shmget");
-        exit(1);
+/* Creates a SysV IPC shared memory segment, attaches to it at its fixed address, and marks it to auto-destroy
+ * when the number of attached processes becomes 0. Returns -1 if the segment could not be created.
+ *
+ * IMPORTANT: There is a small window of vulnerability between shmget and shmctl that
+ * can lead to major issues: between these calls, we have a segment of persistent
+ * memory that will survive the program if it dies (e.g. someone just happens to send us
+ * a SIGKILL)
+ */
+static int gm_create_segment(uint32_t idx, size_t size, uint32_t flags) {
+    int shmflg = 0644 | IPC_CREAT;
+    int shmid = -1;
+    if (flags & GM_HUGEPAGES) {
+        // Huge pages are reserved (no SHM_NORESERVE), otherwise running out of them would SIGBUS on first touch
+        shmid = shmget(IPC_PRIVATE, size, shmflg | SHM_HUGETLB);
+        if (shmid == -1) warn("Could not create global segment %d with huge pages (%s), using regular pages", idx,
+                              strerror(errno));
     }
-    GM = static_cast<gm_segment *>(shmat(gm_shmid, GM_BASE_ADDR, 0));
-    if (GM != GM_BASE_ADDR) {
+    if (shmid == -1) shmid = shmget(IPC_PRIVATE, size, shmflg | (idx ? SHM_NORESERVE : 0));
+    if (shmid == -1) return -1;
+
+    void *base = shmat(shmid, gm_segment_base(idx), 0);
+    if (base != gm_segment_base(idx)) {
         perror("gm_create failed shmat");
-        warn("shmat failed, shmid %d. Trying not to leave garbage behind before dying...", gm_shmid);
-        int ret = shmctl(gm_shmid, IPC_RMID, nullptr);
+        warn("shmat failed, shmid %d. Trying not to leave garbage behind before dying...", shmid);
+        int ret = shmctl(shmid, IPC_RMID, nullptr);
         if (ret) {
             perror("shmctl failed, we're leaving garbage behind!");
-            panic("Check /proc/sysvipc/shm and manually delete segment with shmid %d", gm_shmid);
+            panic("Check /proc/sysvipc/shm and manually delete segment with shmid %d", shmid);
         } else {
             panic("shmctl succeeded, we're dying in peace");
         }
     }
 
     //Mark the segment to auto-destroy when the number of attached processes becomes 0.
-    int ret = shmctl(gm_shmid, IPC_RMID, nullptr);
+    int ret = shmctl(shmid, IPC_RMID, nullptr);
     assert(!ret);
+    return shmid;
+}
 
-    char *alloc_start = reinterpret_cast<char *>(GM) + 1024;
-    size_t alloc_size = segmentSize - 1 - 1024;
-    GM->base_regp = nullptr;
+// Creates the mspace of the next segment. Called at init, then with GM->lock held.
+static void gm_activate_segment() {
+    uint32_t idx = GM->activeSegments;
+    assert(idx < GM->numSegments);
+    char *alloc_start = static_cast<char *>(gm_segment_base(idx));
+    size_t alloc_size = GM->segmentSize - 1;
+    if (idx == 0) {
+        alloc_start += GM_HEADER_BYTES;
+        alloc_size -= GM_HEADER_BYTES;
+    }
+    if (GM->flags & GM_PREFAULT) {
+        // Touch every page now, so the simulation does not take the faults. Pages are shared, so once is enough
+        for (size_t off = 0; off < alloc_size; off += 4096) static_cast<volatile char *>(alloc_start)[off] = 0;
+    }
+    GM->mspaces[idx] = create_mspace_with_base(alloc_start, alloc_size, 1 /*locked*/);
+    assert(GM->mspaces[idx]);
+    GM->activeSegments = idx + 1;
+    if (idx) info("Global heap grew into segment %d (%ld MB)", idx, GM->segmentSize >> 20);
+}
+
+/* Heap segment size, in bytes, and maximum number of segments. Choose something within the machine's limits
+ * (see sysctl vars kernel.shmmax and kernel.shmall); if fewer segments can be created, the heap is smaller.
+ */
+int gm_init(size_t segmentSize, uint32_t maxSegments, uint32_t flags) {
+    assert(GM == nullptr);
+    assert(gm_shmid == 0);
+    if (maxSegments < 1 || maxSegments > GM_MAX_SEGMENTS) panic("Global heap must have 1-%d segments", GM_MAX_SEGMENTS);
+    if (segmentSize > GM_SEGMENT_STRIDE) panic("Global heap segments must be at most %ld MB", GM_SEGMENT_STRIDE >> 20);
+    if (flags & GM_HUGEPAGES) segmentSize = (segmentSize + GM_HUGE_PAGE_BYTES - 1) & ~(GM_HUGE_PAGE_BYTES - 1);
 
-    GM->mspace_ptr = create_mspace_with_base(alloc_start, alloc_size, 1 /*locked*/);
+    gm_shmid = gm_create_segment(0, segmentSize, flags);
+    if (gm_shmid == -1) {
+        perror("gm_create failed shmget");
+        exit(1);
+    }
+    GM = static_cast<gm_segment *>(gm_segment_base(0));
+
+    GM->base_regp = nullptr;
+    GM->segmentSize = segmentSize;
+    GM->flags = flags;
+    GM->shmids[0] = gm_shmid;
+    GM->numSegments = 1;
+    // Create the other segments now, so that gm_attach() can attach them all
+    for (uint32_t i = 1; i < maxSegments; i++) {
+        int shmid = gm_create_segment(i, segmentSize, flags);
+        if (shmid == -1) {
+            warn("Could not create global segment %d (%s), the global heap will have %d segments", i,
+                 strerror(errno), i);
+            break;
+        }
+        GM->shmids[i] = shmid;
+        GM->numSegments++;
+    }
+    GM->activeSegments = 0;
+    gm_activate_segment();
     futex_init(&GM->lock);
-    assert(GM->mspace_ptr);
+
+    GM->shards = static_cast<gm_cache_shard *>(mspace_memalign(GM->mspaces[0], CACHE_LINE_BYTES,
+                                                               GM_CACHE_SHARDS * sizeof(gm_cache_shard)));
+    assert(GM->shards);
+    memset(GM->shards, 0, GM_CACHE_SHARDS * sizeof(gm_cache_shard));
+    for (uint32_t s = 0; s < GM_CACHE_SHARDS; s++) futex_init(&GM->shards[s].lock);
 
     return gm_shmid;
 }
@@ -113,39 +223,137 @@ void gm_attach(int shmid) {
     assert(GM == nullptr);
     assert(gm_shmid == 0);
     gm_shmid = shmid;
-    GM = static_cast<gm_segment *>(shmat(gm_shmid, GM_BASE_ADDR, 0));
-    if (GM != GM_BASE_ADDR) {
+    GM = static_cast<gm_segment *>(shmat(gm_shmid, gm_segment_base(0), 0));
+    if (GM != gm_segment_base(0)) {
         warn("shmid %d \n", shmid);
         panic("gm_attach failed allocation");
     }
+    for (uint32_t i = 1; i < GM->numSegments; i++) {
+        if (shmat(GM->shmids[i], gm_segment_base(i), 0) != gm_segment_base(i)) {
+            panic("gm_attach failed to attach segment %d, shmid %d", i, GM->shmids[i]);
+        }
+    }
+}
+
+/* Runs alloc(mspace) on the active segments in order until it succeeds, growing the heap into the next
+ * segment if all are full; nullptr if the heap cannot grow further. Called with GM->lock held.
+ */
+template<typename F>
+static void *gm_heap_alloc(F alloc) {
+    for (uint32_t i = 0; ; i++) {
+        if (i == GM->activeSegments) {
+            if (i == GM->numSegments) return nullptr;
+            gm_activate_segment();
+        }
+        void *ptr = alloc(GM->mspaces[i]);
+        if (ptr) return ptr;
+    }
+}
+
+static inline mspace gm_mspace_of(void *ptr) {
+    uint64_t idx = ((uintptr_t) ptr - (uintptr_t) GM_BASE_ADDR) / GM_SEGMENT_STRIDE;
+    assert(idx < GM->activeSegments);
+    return GM->mspaces[idx];
 }
 
 
+static inline gm_cache_shard *gm_my_shard() {
+    // Thread stacks are megabytes apart; Fibonacci hashing spreads them over the shards
+    uint64_t sp = reinterpret_cast<uint64_t>(__builtin_frame_address(0));
+    return &GM->shards[((sp >> 21) * 0x9E3779B97F4A7C15ull) >> 58];
+}
+static_assert(GM_CACHE_SHARDS == 64, "gm_my_shard() takes 6 hash bits");
+
+// Pops a block of class c (c + 1 granules), refilling the shard if empty. Called with the shard lock held.
+static void *gm_cache_pop(gm_cache_shard *sh, uint32_t c) {
+    if (!sh->heads[c]) {
+        size_t bytes = (c + 1) * GM_CACHE_GRANULE;
+        futex_lock(&GM->lock);
+        for (uint32_t i = 0; i < GM_CACHE_BATCH; i++) {
+            void *p = gm_heap_alloc([bytes](mspace m) { return mspace_malloc(m, bytes); });
+            if (!p) break;
+            *static_cast<void **>(p) = sh->heads[c];
+            sh->heads[c] = p;
+            sh->counts[c]++;
+        }
+        futex_unlock(&GM->lock);
+        if (!sh->heads[c]) return nullptr;
+    }
+    void *p = sh->heads[c];
+    sh->heads[c] = *static_cast<void **>(p);
+    sh->counts[c]--;
+    return p;
+}
+
+// Returns a block from the thread cache, or nullptr if the block is too large or the shard is busy
+static inline void *gm_cache_alloc(size_t size) {
+    if (size > GM_CACHE_MAX_BYTES) return nullptr;
+    gm_cache_shard *sh = gm_my_shard();
+    if (!futex_trylock(&sh->lock)) return nullptr;
+    void *ptr = gm_cache_pop(sh, size ? (size - 1) / GM_CACHE_GRANULE : 0);
+    futex_unlock(&sh->lock);
+    return ptr;
+}
+
+// Caches a freed block, draining a batch to the mspace if the shard holds too many; false if not cached
+static inline bool gm_cache_free(void *ptr) {
+    size_t usable = mspace_usable_size(ptr);
+    if (usable < GM_CACHE_GRANULE || usable > GM_CACHE_MAX_BYTES + GM_CACHE_GRANULE) return false;
+    gm_cache_shard *sh = gm_my_shard();
+    if (!futex_trylock(&sh->lock)) return false;
+    size_t granules = usable / GM_CACHE_GRANULE;
+    uint32_t c = ((granules < GM_CACHE_CLASSES) ? granules : GM_CACHE_CLASSES) - 1;  // usable >= (c + 1) granules
+    *static_cast<void **>(ptr) = sh->heads[c];
+    sh->heads[c] = ptr;
+    if (++sh->counts[c] > 2 * GM_CACHE_BATCH) {
+        futex_lock(&GM->lock);
+        for (uint32_t i = 0; i < GM_CACHE_BATCH; i++) {
+            void *p = sh->heads[c];
+            sh->heads[c] = *static_cast<void **>(p);
+            mspace_free(gm_mspace_of(p), p);
+        }
+        futex_unlock(&GM->lock);
+        sh->counts[c] -= GM_CACHE_BATCH;
+    }
+    futex_unlock(&sh->lock);
+    return true;
+}
+
 void *gm_malloc(size_t size) {
     assert(GM);
-    assert(GM->mspace_ptr);
-    futex_lock(&GM->lock);
-    void *ptr = mspace_malloc(GM->mspace_ptr, size);
-    futex_unlock(&GM->lock);
+    assert(GM->activeSegments);
+    void *ptr = gm_cache_alloc(size);
+    if (!ptr) {
+        futex_lock(&GM->lock);
+        ptr = gm_heap_alloc([size](mspace m) { return mspace_malloc(m, size); });
+        futex_unlock(&GM->lock);
+    }
     if (!ptr) panic("gm_malloc(): Out of global heap memory, use a larger GM segment");
     return ptr;
 }
 
 void *__gm_calloc(size_t num, size_t size) {
     assert(GM);
-    assert(GM->mspace_ptr);
-    futex_lock(&GM->lock);
-    void *ptr = mspace_calloc(GM->mspace_ptr, num, size);
-    futex_unlock(&GM->lock);
+    assert(GM->activeSegments);
+    void *ptr = nullptr;
+    if (!size || num <= GM_CACHE_MAX_BYTES / size) {  // no overflow
+        ptr = gm_cache_alloc(num * size);
+        if (ptr) memset(ptr, 0, num * size);
+    }
+    if (!ptr) {
+        futex_lock(&GM->lock);
+        ptr = gm_heap_alloc([num, size](mspace m) { return mspace_calloc(m, num, size); });
+        futex_unlock(&GM->lock);
+    }
     if (!ptr) panic("gm_calloc(): Out of global heap memory, use a larger GM segment");
     return ptr;
 }
 
 void *__gm_memalign(size_t blocksize, size_t bytes) {
     assert(GM);
-    assert(GM->mspace_ptr);
+    assert(GM->activeSegments);
     futex_lock(&GM->lock);
-    void *ptr = mspace_memalign(GM->mspace_ptr, blocksize, bytes);
+    void *ptr = gm_heap_alloc([blocksize, bytes](mspace m) { return mspace_memalign(m, blocksize, bytes); });
     futex_unlock(&GM->lock);
     if (!ptr) panic("gm_memalign(): Out of global heap memory, use a larger GM segment");
     return ptr;
@@ -154,9 +362,10 @@ void *__gm_memalign(size_t blocksize, size_t bytes) {
 
 void gm_free(void *ptr) {
     assert(GM);
-    assert(GM->mspace_ptr);
+    assert(GM->activeSegments);
+    if (!ptr || gm_cache_free(ptr)) return;
     futex_lock(&GM->lock);
-    mspace_free(GM->mspace_ptr, ptr);
+    mspace_free(gm_mspace_of(ptr), ptr);
     futex_unlock(&GM->lock);
 }
 
@@ -195,7 +404,18 @@ void *gm_get_secondary_ptr() {
 
 void gm_stats() {
     assert(GM);
-    mspace_malloc_stats(GM->mspace_ptr);
+    futex_lock(&GM->lock);
+    for (uint32_t i = 0; i < GM->numSegments; i++) {
+        if (i < GM->activeSegments) {
+            struct mallinfo mi = mspace_mallinfo(GM->mspaces[i]);
+            // Blocks held by the thread caches count as in use
+            info("Global heap segment %d: %ld MB, %ld MB in use, %ld MB free", i, GM->segmentSize >> 20,
+                 (size_t) mi.uordblks >> 20, (size_t) mi.fordblks >> 20);
+        } else {
+            info("Global heap segment %d: %ld MB, unused", i, GM->segmentSize >> 20);
+        }
+    }
+    futex_unlock(&GM->lock);
 }
 
 bool gm_isready() {
@@ -205,6 +425,7 @@ bool gm_isready() {
 
 void gm_detach() {
     assert(GM);
+    for (uint32_t i = GM->numSegments - 1; i > 0; i--) shmdt(gm_segment_base(i));
     shmdt(GM);
     GM = nullptr;
     gm_shmid = 0;
@@ -26,10 +26,16 @@
 #ifndef GALLOC_H_
 #define GALLOC_H_
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
-int gm_init(size_t segmentSize);
+// gm_init flags
+#define GM_HUGEPAGES (1 << 0)  // back segments with huge pages if possible
+#define GM_PREFAULT (1 << 1)  // touch each segment's pages as it comes into use
+
+// Creates the global heap: maxSegments segments of segmentSize bytes each, used one after the other
+int gm_init(size_t segmentSize, uint32_t maxSegments = 1, uint32_t flags = 0);
 
 void gm_attach(int shmid);
 
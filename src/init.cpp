@@ -117,6 +117,24 @@ BaseCache *BuildCacheBank(Config &config, const string &prefix, g_string &name,
     } else {
         panic("%s: Invalid array type %s", name.c_str(), arrayType.c_str());
     }
+#if !VALUE_TRACKING
+    if (arrayType == "DataAwareSetAssoc" || arrayType == "CompressedDataAwareSetAssoc") {
+        panic("%s: %s arrays keep line values, but value tracking was compiled out (VALUE_TRACKING=0)",
+              name.c_str(), arrayType.c_str());
+    }
+#endif
+
+    // Compressed arrays have more tags than lines' worth of data. Everything indexed by line ID (replacement
+    // policy, coherence state) is sized by tags, and ways is the number of tags per set from here on
+    uint32_t dataWays = ways;
+    if (arrayType == "CompressedDataAwareSetAssoc") {
+        uint32_t tagRatio = config.get<uint32_t>(prefix + "array.tagRatio", 2);
+        if (tagRatio == 0) panic("%s: array.tagRatio must be at least 1", name.c_str());
+        if (type == "Timing") panic("%s: compressed arrays need a Simple or Tracing cache", name.c_str());
+        numLines *= tagRatio;
+        ways *= tagRatio;
+        candidates = ways;
+    }
 
     // Power of two sets check; also compute setBits, will be useful later
     uint32_t numSets = numLines / ways;
@@ -239,7 +257,19 @@ BaseCache *BuildCacheBank(Config &config, const string &prefix, g_string &name,
     //Alright, build the array
     CacheArray *array = nullptr;
     if (arrayType == "CompressedDataAwareSetAssoc"){
-        array = new CompressedDataAwareSetAssoc(numLines, lineSize, ways, rp, hf);
+        uint32_t segmentBytes = config.get<uint32_t>(prefix + "array.segmentBytes", 8);
+        string compressorType = config.get<const char *>(prefix + "array.compressor", "BDI");
+        CompressedDataAwareSetAssoc::Compressor compressor;
+        if (compressorType == "BDI") {
+            compressor = CompressedDataAwareSetAssoc::BDI;
+        } else if (compressorType == "FPC") {
+            compressor = CompressedDataAwareSetAssoc::FPC;
+        } else if (compressorType == "Best") {
+            compressor = CompressedDataAwareSetAssoc::BEST;
+        } else {
+            panic("%s: Invalid array.compressor %s (BDI, FPC or Best)", name.c_str(), compressorType.c_str());
+        }
+        array = new CompressedDataAwareSetAssoc(numLines, lineSize, ways, dataWays, segmentBytes, compressor, rp, hf);
     } else if (arrayType == "DataAwareSetAssoc"){
         array = new DataAwareSetAssocArray(numLines, lineSize, ways, rp, hf);
     } else if (arrayType == "SetAssoc") {
@@ -261,6 +291,19 @@ BaseCache *BuildCacheBank(Config &config, const string &prefix, g_string &name,
         panic("This should not happen, we already checked for it!"); //unless someone changed arrayStr...
     }
 
+    // Arrays that keep values need the cores to capture them, and may detect silent stores
+    if (arrayType == "CompressedDataAwareSetAssoc" || arrayType == "DataAwareSetAssoc") {
+#if VALUE_TRACKING
+        zinfo->dataAwareCaches = true;
+#endif
+        if (config.get<bool>(prefix + "array.silentStores", false)) {
+            uint32_t storePCs = config.get<uint32_t>(prefix + "array.storePCs", 256);
+            if (!isPow2(storePCs)) panic("%s: array.storePCs must be a power of two", name.c_str());
+            static_cast<DataAwareSetAssocArray *>(array)->enableSilentStores(storePCs);
+            zinfo->silentStores = true;
+        }
+    }
+
     //Latency
     uint32_t latency = config.get<uint32_t>(prefix + "latency", 10);
     uint32_t accLat = (isTerminal) ? 0
@@ -669,6 +712,13 @@ static void InitSystem(Config &config) {
                 OOOCore *oooCores;
                 NullCore *nullCores;
             };
+            // Simple and Timing cores simulate each store before it executes, so their values are pre-store, and
+            // every store would look silent (dropping real writebacks)
+            if (zinfo->silentStores && (type == "Simple" || type == "Timing")) {
+                panic("%s: array.silentStores needs OOO cores, %s cores do not pass post-store values",
+                      group, type.c_str());
+            }
+
             if (type == "Simple") {
                 simpleCores = gm_memalign<SimpleCore>(CACHE_LINE_BYTES, cores);
             } else if (type == "Timing") {
@@ -950,11 +1000,28 @@ void SimInit(const char *configFile, const char *outputDir, uint32_t shmid) {
     zinfo->numDomains = config.get<uint32_t>("sim.domains", 1);
     uint32_t numSimThreads = config.get<uint32_t>("sim.contentionThreads", MAX((uint32_t) 1, zinfo->numDomains /
                                                                                              2)); //gives a bit of parallelism, TODO tune
-    zinfo->contentionSim = new ContentionSim(zinfo->numDomains, numSimThreads);
+    //Weave threads switch domains (and steal others' domains) every this many cycles, or when a domain stalls
+    uint64_t sliceCycles = config.get<uint64_t>("sim.contentionSliceCycles", 1000);
+    zinfo->contentionSim = new ContentionSim(zinfo->numDomains, numSimThreads, sliceCycles);
     zinfo->contentionSim->initStats(zinfo->rootStat);
+
+    //Far (beyond 64K cycles) event queue, either one for all domains or one per domain
+    vector<string> farQueues = ParseList<string>(config.get<const char *>("sim.farEventQueue", "Radix"));
+    if (farQueues.size() != 1 && farQueues.size() != zinfo->numDomains) {
+        panic("sim.farEventQueue must have one entry or one per domain (%d), has %ld", zinfo->numDomains,
+              farQueues.size());
+    }
+    for (uint32_t i = 0; i < zinfo->numDomains; i++) {
+        const string &fq = farQueues[(farQueues.size() == 1) ? 0 : i];
+        if (fq == "Radix") zinfo->contentionSim->setFarQueueMode(i, PQ_FAR_RADIX);
+        else if (fq == "Map") zinfo->contentionSim->setFarQueueMode(i, PQ_FAR_MAP);
+        else panic("Invalid far event queue %s (domain %d), must be Radix or Map", fq.c_str(), i);
+    }
     zinfo->eventRecorders = gm_calloc<EventRecorder *>(zinfo->numCores);
 
     zinfo->traceWriters = new g_vector<AccessTraceWriter *>();
+    zinfo->mcTraceWriters = new g_vector<MCTraceWriter *>();
+    zinfo->mcTelemetryWriters = new g_vector<MCTelemetryWriter *>();
 
     // Global simulation values
     zinfo->numPhases = 0;
@@ -1016,6 +1083,7 @@ void SimInit(const char *configFile, const char *outputDir, uint32_t shmid) {
     //Process tree needs this initialized, even though it is part of the memory hierarchy
     zinfo->lineSize = config.get<uint32_t>("sys.lineSize", 64);
     assert(zinfo->lineSize > 0);
+    if (zinfo->lineSize > MAX_LINE_BYTES) panic("sys.lineSize %d > MAX_LINE_BYTES %d", zinfo->lineSize, MAX_LINE_BYTES);
 
     //Port virtualization
     for (uint32_t i = 0; i < MAX_PORT_DOMAINS; i++) zinfo->portVirt[i] = new PortVirtualizer();
@@ -1063,6 +1131,9 @@ void SimInit(const char *configFile, const char *outputDir, uint32_t shmid) {
     //HACK: Read all variables that are read in the harness but not in init
     //This avoids warnings on those elements
     config.get<uint32_t>("sim.gmMBytes", (1 << 10));
+    config.get<uint32_t>("sim.gmSegments", 4);
+    config.get<bool>("sim.gmHugePages", false);
+    config.get<bool>("sim.gmPrefault", false);
     if (!zinfo->attachDebugger) config.get<bool>("sim.deadlockDetection", true);
     config.get<bool>("sim.aslr", false);
 
@@ -4,18 +4,20 @@
 
 void
 LinePlacementPolicy::initialize(Config &config) {
-    srand48_r(rand(), &_buffer);
+    _rngs = gm_memalign<StripeRNG>(CACHE_LINE_BYTES, _mc->getNumStripes());
+    for (uint32_t i = 0; i < _mc->getNumStripes(); i++)
+        srand48_r(rand(), &_rngs[i].buffer);
     _sample_rate = config.get<double>("sys.mem.mcdram.sampleRate");
     _enable_replace = config.get<bool>("sys.mem.mcdram.enableReplace", true);
 }
 
 bool
-LinePlacementPolicy::handleCacheMiss(Way *current_tad) {
-    if (!current_tad->valid)
+LinePlacementPolicy::handleCacheMiss(Set *set, uint64_t set_num) {
+    if (!set->isValid(0))
         return true;
     if (!_enable_replace)
         return false;
     double f;
-    drand48_r(&_buffer, &f);
+    drand48_r(&_rngs[_mc->getStripe(set_num)].buffer, &f);
     return f < _sample_rate;
 }
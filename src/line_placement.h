@@ -2,23 +2,29 @@
 
 #include "config.h"
 #include "memory_hierarchy.h"
+#include "pad.h"
 
 using namespace std;
 
 class MemoryController;
 
-class Way;
+class Set;
 
 class LinePlacementPolicy {
 public:
-    LinePlacementPolicy() {};
+    LinePlacementPolicy(MemoryController *mc) : _mc(mc) {};
 
     void initialize(Config &config);
 
-    bool handleCacheMiss(Way *current_tad);
+    bool handleCacheMiss(Set *set, uint64_t set_num);
 
 private:
-    drand48_data _buffer;
+    MemoryController *_mc;
+    // One random stream per set stripe (see SetStripe)
+    struct StripeRNG {
+        drand48_data buffer;
+    } ATTR_LINE_ALIGNED;
+    StripeRNG *_rngs;
     double _sample_rate;
     bool _enable_replace;
 };
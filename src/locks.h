@@ -205,6 +205,11 @@ static inline bool futex_trylock_nospin_timeout(volatile uint32_t *lock, uint64_
     return false;
 }
 
+// Acquires the lock only if it is free, without spinning or blocking
+static inline bool futex_trylock(volatile uint32_t *lock) {
+    return *lock == 0 && __sync_bool_compare_and_swap(lock, 0, 1);
+}
+
 static inline void futex_unlock(volatile uint32_t *lock) {
     if (__sync_fetch_and_add(lock, -1) != 1) {
         *lock = 0;
@@ -302,6 +302,24 @@ if (unlikely(!(cond))) { \
 #define assert_msg(cond, args...) do { (void)sizeof(cond); } while (0);
 #endif
 
+/* Invariant checking levels, selected at build time with -DCHECK_LEVEL=<n>:
+ * - CHECK_OFF: no checks (release builds, which also drop asserts)
+ * - CHECK_CHEAP: incremental O(1)-ish checks on the structures an operation touches
+ * - CHECK_EXHAUSTIVE: also re-verify whole structures (slow, for debugging)
+ * Guard expensive checks with #if CHECK_LEVEL >= CHECK_EXHAUSTIVE.
+ */
+#define CHECK_OFF 0
+#define CHECK_CHEAP 1
+#define CHECK_EXHAUSTIVE 2
+
+#ifndef CHECK_LEVEL
+#ifdef NASSERT
+#define CHECK_LEVEL CHECK_OFF
+#else
+#define CHECK_LEVEL CHECK_CHEAP
+#endif
+#endif
+
 #define checkpoint()                                            \
     do {                                                        \
         info("%s:%d %s", __FILE__, __LINE__, __FUNCTION__);     \
@@ -5,6 +5,8 @@
 #include "mem_ctrls.h"
 #include "dramsim_mem_ctrl.h"
 #include "ddr_mem.h"
+#include "mc_telemetry.h"
+#include "mc_tracing.h"
 #include "zsim.h"
 
 MemoryController::MemoryController(g_string & name, uint32_t
@@ -14,41 +16,48 @@ uint32_t domain, Config
 :
 _name (name)
         {
-                //Kasraa begin
-                _collect_trace = config.get<bool>("sys.mem.enableTrace", false);
-        if (_collect_trace && _name == "mem-0") {
+        // Several controllers each get a slice of the address space (see SplitAddrMemory) and
+        // must not share output files
+        bool multi_mc = config.get<uint32_t>("sys.mem.controllers", 1) > 1;
+        _trace_writer = nullptr;
+        _collect_trace = config.get<bool>("sys.mem.enableTrace", false);
+        if (_collect_trace) {
+#if MC_TRACE
+            g_string trace_path = config.get<const char *>("sys.mem.trace_path", "./");
 
-            maximumTraceLines = 8000000000;
-            myTraceCurrentLength = 0;
-
-            myTracePath = config.get<const char *>("sys.mem.trace_path", "./");
-
-            if (myTracePath == "./") {
+            if (trace_path == "./") {
                 panic("the trace path is not set in the config file!");
             }
 
-            info("myTracePath = %s", myTracePath.c_str());
+            // With several controllers, each one writes its own shard, <trace_path>.<name>
+            if (multi_mc)
+                trace_path += g_string(".") + _name;
+            info("[%s] MC trace path = %s", _name.c_str(), trace_path.c_str());
 
-            f = fopen(myTracePath.c_str(), "w");
-            futex_init(&_lock);
-        }
-        else
-        {
-            panic("This code is specific for generating trace file");
-            assert(false);
+            // One ring per core; the records of each ring are written out by a background thread
+            uint32_t ring_entries = config.get<uint32_t>("sys.mem.trace_buffer_records", 16 * 1024);
+            uint64_t max_records = config.get<uint64_t>("sys.mem.trace_max_records", 8000000000L);
+            _trace_writer = new MCTraceWriter(trace_path, zinfo->numCores, ring_entries, max_records);
+            zinfo->mcTraceWriters->push_back(_trace_writer);
+#else
+            panic("sys.mem.enableTrace is set, but MC tracing was compiled out (MC_TRACE=0)");
+#endif
         }
-        //Kasraa end
 
         _sram_tag = config.get<bool>("sys.mem.sram_tag", false);
         _llc_latency = config.get<uint32_t>("sys.caches.l2.latency");
         double timing_scale = config.get<double>("sys.mem.dram_timing_scale", 1);
+        (void) multi_mc;  // make gcc happy when DDR/DRAMSim are not built in (mcreplay)
+        (void) timing_scale;
         g_string scheme = config.get<const char *>("sys.mem.cache_scheme", "NoCache");
         _ext_type = config.get<const char *>("sys.mem.ext_dram.type", "Simple");
+        _cache_size = 0;  // no DRAM cache unless a scheme sets it up (telemetry reads _num_sets regardless)
+        _num_sets = 0;
         if (scheme != "NoCache") {
             _granularity = config.get<uint32_t>("sys.mem.mcdram.cache_granularity");
             _num_ways = config.get<uint32_t>("sys.mem.mcdram.num_ways");
             _mcdram_type = config.get<const char *>("sys.mem.mcdram.type", "Simple");
-            _cache_size = config.get<uint32_t>("sys.mem.mcdram.size", 128) * 1024 * 1024;
+            _cache_size = (uint64_t) config.get<uint32_t>("sys.mem.mcdram.size", 128) * 1024 * 1024;  // size is in MB
         }
         if (scheme == "AlloyCache") {
             _scheme = AlloyCache;
@@ -63,6 +72,8 @@ _name (name)
             assert(_granularity == 4096);
             assert(_num_ways == _cache_size / _granularity);
             _scheme = HMA;
+            _os_quantum = config.get<uint64_t>("sys.mem.os_quantum", 100000);
+            assert(_os_quantum > 0);
         } else if (scheme == "HybridCache") {
             // 4KB page or 2MB page
             assert(_granularity == 4096 || _granularity == 4096 * 512);
@@ -84,6 +95,10 @@ _name (name)
         g_string placement_scheme = config.get<const char *>("sys.mem.mcdram.placementPolicy", "LRU");
         _bw_balance = config.get<bool>("sys.mem.bwBalance", false);
         _ds_index = 0;
+        _ds_target = 0;
+        _drain_sets_per_access = config.get<uint32_t>("sys.mem.bwBalanceDrainSets", 1);
+        _drain_start_cycle = 0;
+        futex_init(&_drain_lock);
         if (_bw_balance)
         assert(_scheme == AlloyCache || _scheme == HybridCache);
 
@@ -93,28 +108,38 @@ _name (name)
             uint32_t latency = config.get<uint32_t>("sys.mem.ext_dram.latency", 100);
             _ext_dram = (SimpleMemory *) gm_malloc(sizeof(SimpleMemory));
             new(_ext_dram)    SimpleMemory(latency, ext_dram_name, config);
-        } else if (_ext_type == "DDR")
+        }
+#if !MC_REPLAY
+        else if (_ext_type == "DDR")
         _ext_dram = BuildDDRMemory(config, frequency, domain, ext_dram_name, "sys.mem.ext_dram.", 4, 1.0);
+#endif
         else if (_ext_type == "MD1") {
             uint32_t latency = config.get<uint32_t>("sys.mem.ext_dram.latency", 100);
             uint32_t bandwidth = config.get<uint32_t>("sys.mem.ext_dram.bandwidth", 6400);
             _ext_dram = (MD1Memory *) gm_malloc(sizeof(MD1Memory));
             new(_ext_dram) MD1Memory(64, frequency, bandwidth, latency, ext_dram_name);
-        } else if (_ext_type == "DRAMSim") {
+        }
+#if !MC_REPLAY
+        else if (_ext_type == "DRAMSim") {
             uint64_t cpuFreqHz = 1000000 * frequency;
             uint32_t capacity = config.get<uint32_t>("sys.mem.capacityMB", 16384);
             string dramTechIni = config.get<const char *>("sys.mem.techIni");
             string dramSystemIni = config.get<const char *>("sys.mem.systemIni");
             string outputDir = config.get<const char *>("sys.mem.outputDir");
             string traceName = config.get<const char *>("sys.mem.traceName", "dramsim");
+            if (multi_mc)
+                traceName += "_" + string(_name.c_str());
             traceName += "_ext";
             _ext_dram = (DRAMSimMemory *) gm_malloc(sizeof(DRAMSimMemory));
             uint32_t latency = config.get<uint32_t>("sys.mem.ext_dram.latency", 100);
             new(_ext_dram) DRAMSimMemory(dramTechIni, dramSystemIni, outputDir, traceName, capacity, cpuFreqHz, latency,
                                          domain, name);
-        } else
+        }
+#endif
+        else
         panic("Invalid memory controller type %s", _ext_type.c_str());
 
+        _mcdram_per_mc = 0;
         if (_scheme != NoCache) {
             // Configure the MC-Dram (Timing Model)
             _mcdram_per_mc = config.get<uint32_t>("sys.mem.mcdram.mcdramPerMC", 4);
@@ -128,63 +153,126 @@ _name (name)
                     _mcdram[i] = (SimpleMemory *) gm_malloc(sizeof(SimpleMemory));
                     new(_mcdram[i]) SimpleMemory(latency, mcdram_name, config);
                     //_mcdram[i] = new SimpleMemory(latency, mcdram_name, config);
-                } else if (_mcdram_type == "DDR") {
+                }
+#if !MC_REPLAY
+                else if (_mcdram_type == "DDR") {
                     // XXX HACK tBL for mcdram is 1, so for data access, should multiply by 2, for tad access, should multiply by 3.
                     _mcdram[i] = BuildDDRMemory(config, frequency, domain, mcdram_name, "sys.mem.mcdram.", 4,
                                                 timing_scale);
-                } else if (_mcdram_type == "MD1") {
+                }
+#endif
+                else if (_mcdram_type == "MD1") {
                     uint32_t latency = config.get<uint32_t>("sys.mem.mcdram.latency", 50);
                     uint32_t bandwidth = config.get<uint32_t>("sys.mem.mcdram.bandwidth", 12800);
                     _mcdram[i] = (MD1Memory *) gm_malloc(sizeof(MD1Memory));
                     new(_mcdram[i]) MD1Memory(64, frequency, bandwidth, latency, mcdram_name);
-                } else if (_mcdram_type == "DRAMSim") {
+                }
+#if !MC_REPLAY
+                else if (_mcdram_type == "DRAMSim") {
                     uint64_t cpuFreqHz = 1000000 * frequency;
                     uint32_t capacity = config.get<uint32_t>("sys.mem.capacityMB", 16384);
                     string dramTechIni = config.get<const char *>("sys.mem.techIni");
                     string dramSystemIni = config.get<const char *>("sys.mem.systemIni");
                     string outputDir = config.get<const char *>("sys.mem.outputDir");
                     string traceName = config.get<const char *>("sys.mem.traceName");
+                    if (multi_mc)
+                        traceName += "_" + string(_name.c_str());
                     traceName += "_mc";
                     traceName += to_string(i);
                     _mcdram[i] = (DRAMSimMemory *) gm_malloc(sizeof(DRAMSimMemory));
                     uint32_t latency = config.get<uint32_t>("sys.mem.mcdram.latency", 50);
                     new(_mcdram[i]) DRAMSimMemory(dramTechIni, dramSystemIni, outputDir, traceName, capacity, cpuFreqHz,
                                                   latency, domain, name);
-                } else panic("Invalid memory controller type %s", _mcdram_type.c_str());
+                }
+#endif
+                else panic("Invalid memory controller type %s", _mcdram_type.c_str());
             }
             // Configure MC-Dram Functional Model
             _num_sets = _cache_size / _num_ways / _granularity;
             if (_scheme == Tagless)
             assert(_num_sets == 1);
+            // Single SoA tag store for all sets (see Set)
+            uint64_t mask_words = (_num_ways + 63) / 64;
+            Address *tags = gm_memalign<Address>(CACHE_LINE_BYTES, _num_sets * _num_ways);
+            uint64_t *valid_bits = gm_calloc<uint64_t>(_num_sets * mask_words);
+            uint64_t *dirty_bits = gm_calloc<uint64_t>(_num_sets * mask_words);
             _cache = (Set *) gm_malloc(sizeof(Set) * _num_sets);
             for (uint64_t i = 0; i < _num_sets; i++) {
-                _cache[i].ways = (Way *) gm_malloc(sizeof(Way) * _num_ways);
+                _cache[i].tags = &tags[i * _num_ways];
+                _cache[i].valid_bits = &valid_bits[i * mask_words];
+                _cache[i].dirty_bits = &dirty_bits[i * mask_words];
                 _cache[i].num_ways = _num_ways;
+                if (_num_ways % 64)
+                    _cache[i].valid_bits[mask_words - 1] = ~0ul << (_num_ways % 64);
                 for (uint32_t j = 0; j < _num_ways; j++)
-                    _cache[i].ways[j].valid = false;
+                    _cache[i].tags[j] = 0;
             }
-            if (_scheme == AlloyCache) {
-                _line_placement_policy = (LinePlacementPolicy *) gm_malloc(sizeof(LinePlacementPolicy));
-                new(_line_placement_policy) LinePlacementPolicy();
-                _line_placement_policy->initialize(config);
-            } else if (_scheme == HMA) {
-                _os_placement_policy = (OSPlacementPolicy *) gm_malloc(sizeof(OSPlacementPolicy));
-                new(_os_placement_policy) OSPlacementPolicy(this);
-            } else if (_scheme == UnisonCache || _scheme == HybridCache) {
-                _page_placement_policy = (PagePlacementPolicy *) gm_malloc(sizeof(PagePlacementPolicy));
-                new(_page_placement_policy) PagePlacementPolicy(this);
-                _page_placement_policy->initialize(config);
+        }
+        // Lock striping: a power of 2 number of stripes, at most one per set
+        uint32_t num_stripes = 1;
+        if (_scheme != NoCache) {
+            uint32_t max_stripes = config.get<uint32_t>("sys.mem.mcdram.lockStripes", 64);
+            while (2 * num_stripes <= max_stripes && 2 * num_stripes <= _num_sets)
+                num_stripes *= 2;
+        }
+        _stripe_mask = num_stripes - 1;
+        // Page tables start small and double as the footprint grows; presizing them to the cache's page count
+        // would take GBs up front for multi-GB caches. A footprint hint avoids the early rehashes.
+        uint64_t page_table_entries = config.get<uint64_t>("sys.mem.pageTableEntries", 64 * 1024 * num_stripes);
+        _stripes = gm_memalign<SetStripe>(CACHE_LINE_BYTES, num_stripes);
+        for (uint32_t i = 0; i < num_stripes; i++) {
+            futex_init(&_stripes[i].lock);
+            _stripes[i].tlb = nullptr;
+            if (_scheme != NoCache && _scheme != CacheOnly && _granularity >= 4096) {
+                _stripes[i].tlb = new PageTable(page_table_entries / num_stripes, _num_ways);
             }
+            _stripes[i].num_hit_per_step = 0;
+            _stripes[i].num_miss_per_step = 0;
+            _stripes[i].mc_bw_per_step = 0;
+            _stripes[i].ext_bw_per_step = 0;
+        }
+        _channel_locks = gm_memalign<ChannelLock>(CACHE_LINE_BYTES, _mcdram_per_mc + 1);
+        for (uint32_t i = 0; i <= _mcdram_per_mc; i++) {
+            futex_init(&_channel_locks[i].lock);
+            _channel_locks[i].bursts = 0;
+        }
+        futex_init(&_tag_buffer_lock);
+        // Placement policies keep per-stripe state
+        if (_scheme == AlloyCache) {
+            _line_placement_policy = (LinePlacementPolicy *) gm_malloc(sizeof(LinePlacementPolicy));
+            new(_line_placement_policy) LinePlacementPolicy(this);
+            _line_placement_policy->initialize(config);
+        } else if (_scheme == HMA) {
+            _os_placement_policy = (OSPlacementPolicy *) gm_malloc(sizeof(OSPlacementPolicy));
+            new(_os_placement_policy) OSPlacementPolicy(this);
+        } else if (_scheme == UnisonCache || _scheme == HybridCache) {
+            _page_placement_policy = (PagePlacementPolicy *) gm_malloc(sizeof(PagePlacementPolicy));
+            new(_page_placement_policy) PagePlacementPolicy(this);
+            _page_placement_policy->initialize(config);
         }
         if (_scheme == HybridCache) {
             _tag_buffer = (TagBuffer *) gm_malloc(sizeof(TagBuffer));
             new(_tag_buffer) TagBuffer(config);
         }
+        // Telemetry, written next to the stats files unless sys.mem.telemetryFile is set
+        _telemetry = nullptr;
+        _telemetry_interval = config.get<uint64_t>("sys.mem.telemetryInterval", 0);
+        if (_telemetry_interval) {
+            g_string telemetry_path = config.get<const char *>("sys.mem.telemetryFile", "");
+            if (telemetry_path.empty()) {
+                assert(zinfo->outputDir);
+                telemetry_path = g_string(zinfo->outputDir) + "/" + _name + ".telemetry";
+            } else if (multi_mc) {
+                telemetry_path += g_string(".") + _name;
+            }
+            info("[%s] MC telemetry every %ld cycles to %s", _name.c_str(), _telemetry_interval,
+                 telemetry_path.c_str());
+            _telemetry = new MCTelemetryWriter(telemetry_path, _telemetry_interval, _num_sets);
+            zinfo->mcTelemetryWriters->push_back(_telemetry);
+            _telemetry_next_cycle = _telemetry_interval;
+            futex_init(&_telemetry_lock);
+        }
         // Stats
-        _num_hit_per_step = 0;
-        _num_miss_per_step = 0;
-        _mc_bw_per_step = 0;
-        _ext_bw_per_step = 0;
         for (uint32_t i = 0; i < MAX_STEPS; i++)
         _miss_rate_trace[i] = 0;
         _num_requests = 0;
@@ -205,38 +293,29 @@ MemoryController::access(MemReq &req) {
             break;
         default: panic("!?");
     }
+    // ignore clean LLC eviction
     if (req.type == PUTS)
         return req.cycle;
-    futex_lock(&_lock);
-    // ignore clean LLC eviction
-
-    //Kasraa begin
-    if (_collect_trace && _name == "mem-0") {
-
-        fprintf(f, "%lu\t", (uint64_t) req.pc);
-        fprintf(f, "%lu\t", (uint64_t) req.lineAddr);
-        fprintf(f, "%d\t", (req.type == PUTX) ? 1 : 0);
-        fprintf(f, "%d\n", (uint32_t) req.srcId);
 
-        myTraceCurrentLength++;
-        assert(myTraceCurrentLength <= maximumTraceLines);
+#if MC_TRACE
+    // Traced outside the lock; the writer restores arrival order
+    if (_trace_writer)
+        _trace_writer->write(req.pc, req.lineAddr, req.type == PUTX, req.srcId, req.cycle);
+#endif
 
-        if (myTraceCurrentLength == maximumTraceLines) {
-            fclose(f);
-            info("We reached the maximum size of trace!");
-            assert(false);
+    uint64_t req_num = __sync_add_and_fetch(&_num_requests, 1);
+    if (_telemetry && req.cycle >= _telemetry_next_cycle && futex_trylock(&_telemetry_lock)) {
+        // Whoever takes the lock first samples; the others just move on
+        if (req.cycle >= _telemetry_next_cycle) {
+            sampleTelemetry(req.cycle);
+            _telemetry_next_cycle = (req.cycle / _telemetry_interval + 1) * _telemetry_interval;
         }
-    } else {
-        assert(false);
+        futex_unlock(&_telemetry_lock);
     }
-    //Kasraa end
-
-    _num_requests++;
     if (_scheme == NoCache) {
         ///////   load from external dram
-        req.cycle = _ext_dram->access(req, 0, 4);
-        _numLoadHit.inc();
-        futex_unlock(&_lock);
+        req.cycle = extDramAccess(req, 0, 4);
+        _numLoadHit.atomicInc(0);
         return req.cycle;
         ////////////////////////////////////
     }
@@ -260,61 +339,68 @@ MemoryController::access(MemReq &req) {
     if (_scheme == CacheOnly) {
         ///////   load from mcdram
         req.lineAddr = mc_address;
-        req.cycle = _mcdram[mcdram_select]->access(req, 0, 4);
+        req.cycle = mcdramAccess(mcdram_select, req, 0, 4);
         req.lineAddr = address;
-        _numLoadHit.inc();
-        futex_unlock(&_lock);
+        _numLoadHit.atomicInc(getStripe(set_num));
         return req.cycle;
         ////////////////////////////////////
     }
     uint64_t step_length = _cache_size / 64 / 10;
 
+    // Functional state of the set, placement metadata and stats slots are protected by the stripe lock
+    uint32_t stripe_idx = getStripe(set_num);
+    SetStripe &stripe = _stripes[stripe_idx];
+    futex_lock(&stripe.lock);
+
     // whether needs to probe tag for HybridCache.
     // need to do so for LLC dirty eviction and if the page is not in TB
     bool hybrid_tag_probe = false;
+    TLBEntry *tlb_entry = nullptr;  // page-granularity schemes only
     if (_granularity >= 4096) {
-        if (_tlb.find(tag) == _tlb.end())
-            _tlb[tag] = TLBEntry {tag, _num_ways, 0, 0, 0};
-        if (_tlb[tag].way != _num_ways) {
-            hit_way = _tlb[tag].way;
-            assert(_cache[set_num].ways[hit_way].valid && _cache[set_num].ways[hit_way].tag == tag);
-        } else if (_scheme != Tagless) {
-            // for Tagless, this assertion takes too much time.
-            for (uint32_t i = 0; i < _num_ways; i++)
-            assert(_cache[set_num].ways[i].tag != tag || !_cache[set_num].ways[i].valid);
+        tlb_entry = stripe.tlb->get(tag);
+        if (tlb_entry->way != _num_ways) {
+            hit_way = tlb_entry->way;
+            assert(_cache[set_num].isValid(hit_way) && _cache[set_num].getTag(hit_way) == tag);
         }
+#if CHECK_LEVEL >= CHECK_EXHAUSTIVE
+        else
+            assert(_cache[set_num].findTag(tag) == _num_ways);
+#endif
 
         if (_scheme == UnisonCache) {
             //// Tag and data access. For simplicity, use a single access.
             if (type == LOAD) {
                 req.lineAddr = mc_address; //transMCAddressPage(set_num, 0); //mc_address;
-                req.cycle = _mcdram[mcdram_select]->access(req, 0, 6);
-                _mc_bw_per_step += 6;
-                _numTagLoad.inc();
+                req.cycle = mcdramAccess(mcdram_select, req, 0, 6);
+                stripe.mc_bw_per_step += 6;
+                _numTagLoad.inc(stripe_idx);
                 req.lineAddr = address;
             } else {
                 assert(type == STORE);
                 MemReq tag_probe = {mc_address, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState,
                                     req.srcId, req.flags};
-                req.cycle = _mcdram[mcdram_select]->access(tag_probe, 0, 2);
-                _mc_bw_per_step += 2;
-                _numTagLoad.inc();
+                req.cycle = mcdramAccess(mcdram_select, tag_probe, 0, 2);
+                stripe.mc_bw_per_step += 2;
+                _numTagLoad.inc(stripe_idx);
             }
             ///////////////////////////////
         }
         if (_scheme == HybridCache && type == STORE) {
-            if (_tag_buffer->existInTB(tag) == _tag_buffer->getNumWays() && set_num >= _ds_index) {
-                _numTBDirtyMiss.inc();
+            futex_lock(&_tag_buffer_lock);
+            bool tb_miss = _tag_buffer->existInTB(tag) == _tag_buffer->getNumWays();
+            futex_unlock(&_tag_buffer_lock);
+            if (tb_miss && set_num >= _ds_index) {
+                _numTBDirtyMiss.inc(stripe_idx);
                 if (!_sram_tag)
                     hybrid_tag_probe = true;
             } else
-                _numTBDirtyHit.inc();
+                _numTBDirtyHit.inc(stripe_idx);
         }
         if (_scheme == HybridCache && _sram_tag)
             req.cycle += _llc_latency;
     } else {
         assert(_scheme == AlloyCache);
-        if (_cache[set_num].ways[0].valid && _cache[set_num].ways[0].tag == tag && set_num >= _ds_index)
+        if (_cache[set_num].isValid(0) && _cache[set_num].getTag(0) == tag && set_num >= _ds_index)
             hit_way = 0;
         if (type == LOAD && set_num >= _ds_index) {
             ///// mcdram TAD access
@@ -323,17 +409,17 @@ MemoryController::access(MemReq &req) {
                 req.cycle += _llc_latency;
 /*				if (hit_way == 0) {
 					req.lineAddr = mc_address; 
-					req.cycle = _mcdram[mcdram_select]->access(req, 0, 4);
-					_mc_bw_per_step += 4;
-					_numTagLoad.inc();
+					req.cycle = mcdramAccess(mcdram_select, req, 0, 4);
+					stripe.mc_bw_per_step += 4;
+					_numTagLoad.inc(stripe_idx);
 					req.lineAddr = address;
 				}
 */
             } else {
                 req.lineAddr = mc_address;
-                req.cycle = _mcdram[mcdram_select]->access(req, 0, 6);
-                _mc_bw_per_step += 6;
-                _numTagLoad.inc();
+                req.cycle = mcdramAccess(mcdram_select, req, 0, 6);
+                stripe.mc_bw_per_step += 6;
+                _numTagLoad.inc(stripe_idx);
                 req.lineAddr = address;
             }
             ///////////////////////////////
@@ -348,20 +434,20 @@ MemoryController::access(MemReq &req) {
     // use the following state for requests, so that req.state is not changed
     if (!cache_hit) {
         uint64_t cur_cycle = req.cycle;
-        _num_miss_per_step++;
+        stripe.num_miss_per_step++;
         if (type == LOAD)
-            _numLoadMiss.inc();
+            _numLoadMiss.inc(stripe_idx);
         else
-            _numStoreMiss.inc();
+            _numStoreMiss.inc(stripe_idx);
 
         uint32_t replace_way = _num_ways;
         if (_scheme == AlloyCache) {
             bool place = false;
             if (set_num >= _ds_index)
-                place = _line_placement_policy->handleCacheMiss(&_cache[set_num].ways[0]);
+                place = _line_placement_policy->handleCacheMiss(&_cache[set_num], set_num);
             replace_way = place ? 0 : 1;
         } else if (_scheme == HMA)
-            _os_placement_policy->handleCacheAccess(tag, type);
+            _os_placement_policy->handleCacheAccess(tlb_entry, type);
         else if (_scheme == Tagless) {
             replace_way = _next_evict_idx;
             _next_evict_idx = (_next_evict_idx + 1) % _num_ways;
@@ -375,55 +461,55 @@ MemoryController::access(MemReq &req) {
         if (_scheme == AlloyCache) {
             if (type == LOAD) {
                 if (!_sram_tag && set_num >= _ds_index)
-                    req.cycle = _ext_dram->access(req, 1, 4);
+                    req.cycle = extDramAccess(req, 1, 4);
                 else
-                    req.cycle = _ext_dram->access(req, 0, 4);
-                _ext_bw_per_step += 4;
+                    req.cycle = extDramAccess(req, 0, 4);
+                stripe.ext_bw_per_step += 4;
                 data_ready_cycle = req.cycle;
             } else if (type == STORE && replace_way >= _num_ways) {
                 // no replacement
-                req.cycle = _ext_dram->access(req, 0, 4);
-                _ext_bw_per_step += 4;
+                req.cycle = extDramAccess(req, 0, 4);
+                stripe.ext_bw_per_step += 4;
                 data_ready_cycle = req.cycle;
             } else if (type == STORE) { // && replace_way < _num_ways)
                 MemReq load_req = {address, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState,
                                    req.srcId, req.flags};
-                req.cycle = _ext_dram->access(load_req, 0, 4);
-                _ext_bw_per_step += 4;
+                req.cycle = extDramAccess(load_req, 0, 4);
+                stripe.ext_bw_per_step += 4;
                 data_ready_cycle = req.cycle;
             }
         } else if (_scheme == HMA) {
-            req.cycle = _ext_dram->access(req, 0, 4);
-            _ext_bw_per_step += 4;
+            req.cycle = extDramAccess(req, 0, 4);
+            stripe.ext_bw_per_step += 4;
             data_ready_cycle = req.cycle;
         } else if (_scheme == UnisonCache) {
             if (type == LOAD) {
-                req.cycle = _ext_dram->access(req, 1, 4);
-                _ext_bw_per_step += 4;
+                req.cycle = extDramAccess(req, 1, 4);
+                stripe.ext_bw_per_step += 4;
             } else if (type == STORE && replace_way >= _num_ways) {
-                req.cycle = _ext_dram->access(req, 1, 4);
-                _ext_bw_per_step += 4;
+                req.cycle = extDramAccess(req, 1, 4);
+                stripe.ext_bw_per_step += 4;
             }
             data_ready_cycle = req.cycle;
         } else if (_scheme == HybridCache) {
             if (hybrid_tag_probe) {
                 MemReq tag_probe = {mc_address, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState,
                                     req.srcId, req.flags};
-                req.cycle = _mcdram[mcdram_select]->access(tag_probe, 0, 2);
-                _mc_bw_per_step += 2;
-                req.cycle = _ext_dram->access(req, 1, 4);
-                _ext_bw_per_step += 4;
-                _numTagLoad.inc();
+                req.cycle = mcdramAccess(mcdram_select, tag_probe, 0, 2);
+                stripe.mc_bw_per_step += 2;
+                req.cycle = extDramAccess(req, 1, 4);
+                stripe.ext_bw_per_step += 4;
+                _numTagLoad.inc(stripe_idx);
                 data_ready_cycle = req.cycle;
             } else {
-                req.cycle = _ext_dram->access(req, 0, 4);
-                _ext_bw_per_step += 4;
+                req.cycle = extDramAccess(req, 0, 4);
+                stripe.ext_bw_per_step += 4;
                 data_ready_cycle = req.cycle;
             }
         } else if (_scheme == Tagless) {
             assert(_ext_dram);
-            req.cycle = _ext_dram->access(req, 0, 4);
-            _ext_bw_per_step += 4;
+            req.cycle = extDramAccess(req, 0, 4);
+            stripe.ext_bw_per_step += 4;
             data_ready_cycle = req.cycle;
         }
         ////////////////////////////////////
@@ -435,75 +521,66 @@ MemoryController::access(MemReq &req) {
                 MemReq insert_req = {mc_address, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState,
                                      req.srcId, req.flags};
                 uint32_t size = _sram_tag ? 4 : 6;
-                _mcdram[mcdram_select]->access(insert_req, 2, size);
-                _mc_bw_per_step += size;
-                _numTagStore.inc();
+                mcdramAccess(mcdram_select, insert_req, 2, size);
+                stripe.mc_bw_per_step += size;
+                _numTagStore.inc(stripe_idx);
             } else if (_scheme == UnisonCache || _scheme == HybridCache || _scheme == Tagless) {
                 uint32_t access_size = (_scheme == UnisonCache || _scheme == Tagless) ? _footprint_size : (
                         _granularity / 64);
                 // load page from ext dram
                 MemReq load_req = {tag * 64, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState,
                                    req.srcId, req.flags};
-                _ext_dram->access(load_req, 2, access_size * 4);
-                _ext_bw_per_step += access_size * 4;
+                extDramAccess(load_req, 2, access_size * 4);
+                stripe.ext_bw_per_step += access_size * 4;
                 // store the page to mcdram
                 MemReq insert_req = {mc_address, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState,
                                      req.srcId, req.flags};
-                _mcdram[mcdram_select]->access(insert_req, 2, access_size * 4);
-                _mc_bw_per_step += access_size * 4;
+                mcdramAccess(mcdram_select, insert_req, 2, access_size * 4);
+                stripe.mc_bw_per_step += access_size * 4;
                 if (_scheme == Tagless) {
                     MemReq load_gipt_req = {tag * 64, GETS, req.childId, &state, req.cycle, req.childLock,
                                             req.initialState, req.srcId, req.flags};
                     MemReq store_gipt_req = {tag * 64, PUTS, req.childId, &state, req.cycle, req.childLock,
                                              req.initialState, req.srcId, req.flags};
-                    _ext_dram->access(load_gipt_req, 2, 2); // update GIPT
-                    _ext_dram->access(store_gipt_req, 2, 2); // update GIPT
-                    _ext_bw_per_step += 4;
+                    extDramAccess(load_gipt_req, 2, 2); // update GIPT
+                    extDramAccess(store_gipt_req, 2, 2); // update GIPT
+                    stripe.ext_bw_per_step += 4;
                 } else if (!_sram_tag) {
-                    _mcdram[mcdram_select]->access(insert_req, 2, 2); // store tag
-                    _mc_bw_per_step += 2;
+                    mcdramAccess(mcdram_select, insert_req, 2, 2); // store tag
+                    stripe.mc_bw_per_step += 2;
                 }
-                _numTagStore.inc();
+                _numTagStore.inc(stripe_idx);
             }
 
             ///////////////////////////////
-            _numPlacement.inc();
-            if (_cache[set_num].ways[replace_way].valid) {
-                Address replaced_tag = _cache[set_num].ways[replace_way].tag;
+            _numPlacement.inc(stripe_idx);
+            if (_cache[set_num].isValid(replace_way)) {
+                Address replaced_tag = _cache[set_num].getTag(replace_way);
                 // Note that tag_buffer is not updated if placed into an invalid entry.
                 // this is like ignoring the initialization cost
-                if (_scheme == HybridCache) {
-                    // Update TagBuffer
-                    //if (!_tag_buffer->canInsert(tag, replaced_tag)) {
-                    //	printf("!!!!!!Occupancy = %f\n", _tag_buffer->getOccupancy());
-                    //	_tag_buffer->clearTagBuffer();
-                    //	_numTagBufferFlush.inc();
-                    //}
-                    //assert (_tag_buffer->canInsert(tag, replaced_tag));
-                    assert(_tag_buffer->canInsert(tag, replaced_tag));
-                    {
-                        _tag_buffer->insert(tag, true);
-                        _tag_buffer->insert(replaced_tag, true);
-                    }
-                    //else {
-                    //	goto end;
-                    //}
-                }
+                // HybridCache: the placement policy already recorded tag and replaced_tag in the tag buffer
+                // (tryRemapInTagBuffer), or it would not have picked a valid way
 
-                _tlb[replaced_tag].way = _num_ways;
                 // only used for UnisonCache
-                uint32_t unison_dirty_lines = __builtin_popcountll(_tlb[replaced_tag].dirty_bitvec) * 4;
-                uint32_t unison_touch_lines = __builtin_popcountll(_tlb[replaced_tag].touch_bitvec) * 4;
+                uint32_t unison_dirty_lines = 0;
+                uint32_t unison_touch_lines = 0;
+                if (tlb_entry) {
+                    TLBEntry *replaced_entry = stripe.tlb->lookup(replaced_tag);
+                    assert(replaced_entry && replaced_entry->way == replace_way);
+                    replaced_entry->way = _num_ways;
+                    unison_dirty_lines = __builtin_popcountll(replaced_entry->dirty_bitvec) * 4;
+                    unison_touch_lines = __builtin_popcountll(replaced_entry->touch_bitvec) * 4;
+                }
                 if (_scheme == UnisonCache || _scheme == Tagless) {
                     assert(unison_touch_lines > 0);
                     assert(unison_touch_lines <= 64);
                     assert(unison_dirty_lines <= 64);
-                    _numTouchedLines.inc(unison_touch_lines);
-                    _numEvictedLines.inc(unison_dirty_lines);
+                    _numTouchedLines.inc(stripe_idx, unison_touch_lines);
+                    _numEvictedLines.inc(stripe_idx, unison_dirty_lines);
                 }
 
-                if (_cache[set_num].ways[replace_way].dirty) {
-                    _numDirtyEviction.inc();
+                if (_cache[set_num].isDirty(replace_way)) {
+                    _numDirtyEviction.inc(stripe_idx);
                     ///////   store dirty line back to external dram
                     // Store starts after TAD is loaded.
                     // request not on critical path.
@@ -512,80 +589,82 @@ MemoryController::access(MemReq &req) {
                             if (_sram_tag) {
                                 MemReq load_req = {mc_address, GETS, req.childId, &state, cur_cycle, req.childLock,
                                                    req.initialState, req.srcId, req.flags};
-                                req.cycle = _mcdram[mcdram_select]->access(load_req, 2, 4);
-                                _mc_bw_per_step += 4;
+                                req.cycle = mcdramAccess(mcdram_select, load_req, 2, 4);
+                                stripe.mc_bw_per_step += 4;
                                 //_numTagLoad.inc();
                             }
                         }
-                        MemReq wb_req = {_cache[set_num].ways[replace_way].tag, PUTX, req.childId, &state, cur_cycle,
+                        MemReq wb_req = {replaced_tag, PUTX, req.childId, &state, cur_cycle,
                                          req.childLock, req.initialState, req.srcId, req.flags};
-                        _ext_dram->access(wb_req, 2, 4);
-                        _ext_bw_per_step += 4;
+                        extDramAccess(wb_req, 2, 4);
+                        stripe.ext_bw_per_step += 4;
                     } else if (_scheme == HybridCache) {
                         // load page from mcdram
                         MemReq load_req = {mc_address, GETS, req.childId, &state, cur_cycle, req.childLock,
                                            req.initialState, req.srcId, req.flags};
-                        _mcdram[mcdram_select]->access(load_req, 2, (_granularity / 64) * 4);
-                        _mc_bw_per_step += (_granularity / 64) * 4;
+                        mcdramAccess(mcdram_select, load_req, 2, (_granularity / 64) * 4);
+                        stripe.mc_bw_per_step += (_granularity / 64) * 4;
                         // store page to ext dram
                         // TODO. this event should be appended under the one above.
                         // but they are parallel right now.
-                        MemReq wb_req = {_cache[set_num].ways[replace_way].tag * 64, PUTX, req.childId, &state,
+                        MemReq wb_req = {replaced_tag * 64, PUTX, req.childId, &state,
                                          cur_cycle, req.childLock, req.initialState, req.srcId, req.flags};
-                        _ext_dram->access(wb_req, 2, (_granularity / 64) * 4);
-                        _ext_bw_per_step += (_granularity / 64) * 4;
+                        extDramAccess(wb_req, 2, (_granularity / 64) * 4);
+                        stripe.ext_bw_per_step += (_granularity / 64) * 4;
                     } else if (_scheme == UnisonCache || _scheme == Tagless) {
                         assert(unison_dirty_lines > 0);
                         // load page from mcdram
                         assert(unison_dirty_lines <= 64);
                         MemReq load_req = {mc_address, GETS, req.childId, &state, cur_cycle, req.childLock,
                                            req.initialState, req.srcId, req.flags};
-                        _mcdram[mcdram_select]->access(load_req, 2, unison_dirty_lines * 4);
-                        _mc_bw_per_step += unison_dirty_lines * 4;
+                        mcdramAccess(mcdram_select, load_req, 2, unison_dirty_lines * 4);
+                        stripe.mc_bw_per_step += unison_dirty_lines * 4;
                         // store page to ext dram
                         // TODO. this event should be appended under the one above.
                         // but they are parallel right now.
-                        MemReq wb_req = {_cache[set_num].ways[replace_way].tag * 64, PUTX, req.childId, &state,
+                        MemReq wb_req = {replaced_tag * 64, PUTX, req.childId, &state,
                                          cur_cycle, req.childLock, req.initialState, req.srcId, req.flags};
-                        _ext_dram->access(wb_req, 2, unison_dirty_lines * 4);
-                        _ext_bw_per_step += unison_dirty_lines * 4;
+                        extDramAccess(wb_req, 2, unison_dirty_lines * 4);
+                        stripe.ext_bw_per_step += unison_dirty_lines * 4;
                         if (_scheme == Tagless) {
                             MemReq load_gipt_req = {tag * 64, GETS, req.childId, &state, req.cycle, req.childLock,
                                                     req.initialState, req.srcId, req.flags};
                             MemReq store_gipt_req = {tag * 64, PUTS, req.childId, &state, req.cycle, req.childLock,
                                                      req.initialState, req.srcId, req.flags};
-                            _ext_dram->access(load_gipt_req, 2, 2); // update GIPT
-                            _ext_dram->access(store_gipt_req, 2, 2); // update GIPT
-                            _ext_bw_per_step += 4;
+                            extDramAccess(load_gipt_req, 2, 2); // update GIPT
+                            extDramAccess(store_gipt_req, 2, 2); // update GIPT
+                            stripe.ext_bw_per_step += 4;
                         }
                     }
 
                     /////////////////////////////
                 } else {
-                    _numCleanEviction.inc();
+                    _numCleanEviction.inc(stripe_idx);
                     if (_scheme == UnisonCache || _scheme == Tagless)
                     assert(unison_dirty_lines == 0);
                 }
             }
-            _cache[set_num].ways[replace_way].valid = true;
-            _cache[set_num].ways[replace_way].tag = tag;
-            _cache[set_num].ways[replace_way].dirty = (req.type == PUTX);
-            _tlb[tag].way = replace_way;
+            _cache[set_num].fill(replace_way, tag, req.type == PUTX);
+            if (tlb_entry)
+                tlb_entry->way = replace_way;
             if (_scheme == UnisonCache || _scheme == Tagless) {
                 uint64_t bit = (address - tag * 64) / 4;
                 assert(bit < 16 && bit >= 0);
                 bit = ((uint64_t) 1UL) << bit;
-                _tlb[tag].touch_bitvec = 0;
-                _tlb[tag].dirty_bitvec = 0;
-                _tlb[tag].touch_bitvec |= bit;
+                tlb_entry->touch_bitvec = 0;
+                tlb_entry->dirty_bitvec = 0;
+                tlb_entry->touch_bitvec |= bit;
                 if (type == STORE)
-                    _tlb[tag].dirty_bitvec |= bit;
+                    tlb_entry->dirty_bitvec |= bit;
             }
         } else {
             // Miss but no replacement
-            if (_scheme == HybridCache)
-                if (type == LOAD && _tag_buffer->canInsert(tag))
+            if (_scheme == HybridCache && type == LOAD) {
+                futex_lock(&_tag_buffer_lock);
+                if (_tag_buffer->canInsert(tag))
                     _tag_buffer->insert(tag, false);
+                futex_unlock(&_tag_buffer_lock);
+            }
             assert(_scheme != Tagless)
         }
     } else { // cache_hit == true
@@ -594,81 +673,85 @@ MemoryController::access(MemReq &req) {
             if (type == LOAD && _sram_tag) {
                 MemReq read_req = {mc_address, GETX, req.childId, &state, req.cycle, req.childLock, req.initialState,
                                    req.srcId, req.flags};
-                req.cycle = _mcdram[mcdram_select]->access(read_req, 0, 4);
-                _mc_bw_per_step += 4;
+                req.cycle = mcdramAccess(mcdram_select, read_req, 0, 4);
+                stripe.mc_bw_per_step += 4;
             }
             if (type == STORE) {
                 // LLC dirty eviction hit
                 MemReq write_req = {mc_address, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState,
                                     req.srcId, req.flags};
-                req.cycle = _mcdram[mcdram_select]->access(write_req, 0, 4);
-                _mc_bw_per_step += 4;
+                req.cycle = mcdramAccess(mcdram_select, write_req, 0, 4);
+                stripe.mc_bw_per_step += 4;
             }
         } else if (_scheme == UnisonCache && type == STORE) {
             // LLC dirty eviction hit
             MemReq write_req = {mc_address, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState,
                                 req.srcId, req.flags};
-            req.cycle = _mcdram[mcdram_select]->access(write_req, 1, 4);
-            _mc_bw_per_step += 4;
+            req.cycle = mcdramAccess(mcdram_select, write_req, 1, 4);
+            stripe.mc_bw_per_step += 4;
         }
         if (_scheme == AlloyCache || _scheme == UnisonCache)
             data_ready_cycle = req.cycle;
-        _num_hit_per_step++;
+        stripe.num_hit_per_step++;
         if (_scheme == HMA)
-            _os_placement_policy->handleCacheAccess(tag, type);
+            _os_placement_policy->handleCacheAccess(tlb_entry, type);
         else if (_scheme == HybridCache || _scheme == UnisonCache) {
             _page_placement_policy->handleCacheHit(tag, type, set_num, &_cache[set_num], counter_access, hit_way);
         }
 
 
         if (req.type == PUTX) {
-            _numStoreHit.inc();
-            _cache[set_num].ways[hit_way].dirty = true;
+            _numStoreHit.inc(stripe_idx);
+            _cache[set_num].setDirty(hit_way);
         } else
-            _numLoadHit.inc();
+            _numLoadHit.inc(stripe_idx);
 
         if (_scheme == HybridCache) {
             if (!hybrid_tag_probe) {
                 req.lineAddr = mc_address;
-                req.cycle = _mcdram[mcdram_select]->access(req, 0, 4);
-                _mc_bw_per_step += 4;
+                req.cycle = mcdramAccess(mcdram_select, req, 0, 4);
+                stripe.mc_bw_per_step += 4;
                 req.lineAddr = address;
                 data_ready_cycle = req.cycle;
-                if (type == LOAD && _tag_buffer->canInsert(tag))
-                    _tag_buffer->insert(tag, false);
+                if (type == LOAD) {
+                    futex_lock(&_tag_buffer_lock);
+                    if (_tag_buffer->canInsert(tag))
+                        _tag_buffer->insert(tag, false);
+                    futex_unlock(&_tag_buffer_lock);
+                }
             } else {
                 assert(!_sram_tag);
                 MemReq tag_probe = {mc_address, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState,
                                     req.srcId, req.flags};
-                req.cycle = _mcdram[mcdram_select]->access(tag_probe, 0, 2);
-                _mc_bw_per_step += 2;
-                _numTagLoad.inc();
+                req.cycle = mcdramAccess(mcdram_select, tag_probe, 0, 2);
+                stripe.mc_bw_per_step += 2;
+                _numTagLoad.inc(stripe_idx);
                 req.lineAddr = mc_address;
-                req.cycle = _mcdram[mcdram_select]->access(req, 1, 4);
-                _mc_bw_per_step += 4;
+                req.cycle = mcdramAccess(mcdram_select, req, 1, 4);
+                stripe.mc_bw_per_step += 4;
                 req.lineAddr = address;
                 data_ready_cycle = req.cycle;
             }
         } else if (_scheme == Tagless) {
             req.lineAddr = mc_address;
-            req.cycle = _mcdram[mcdram_select]->access(req, 0, 4);
-            _mc_bw_per_step += 4;
+            req.cycle = mcdramAccess(mcdram_select, req, 0, 4);
+            stripe.mc_bw_per_step += 4;
             req.lineAddr = address;
             data_ready_cycle = req.cycle;
 
             uint64_t bit = (address - tag * 64) / 4;
             assert(bit < 16 && bit >= 0);
             bit = ((uint64_t) 1UL) << bit;
-            _tlb[tag].touch_bitvec |= bit;
+            tlb_entry->touch_bitvec |= bit;
             if (type == STORE)
-                _tlb[tag].dirty_bitvec |= bit;
+                tlb_entry->dirty_bitvec |= bit;
         }
 
         //// data access
         if (_scheme == HMA) {
             req.lineAddr = mc_address; //transMCAddressPage(set_num, hit_way); //mc_address;
-            req.cycle = _mcdram[mcdram_select]->access(req, 0, 4);
-            _mc_bw_per_step += 4;
+            req.cycle = mcdramAccess(mcdram_select, req, 0, 4);
+            stripe.mc_bw_per_step += 4;
             req.lineAddr = address;
             data_ready_cycle = req.cycle;
         }
@@ -676,15 +759,15 @@ MemoryController::access(MemReq &req) {
             // Update LRU information for UnisonCache
             MemReq tag_update_req = {mc_address, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState,
                                      req.srcId, req.flags};
-            _mcdram[mcdram_select]->access(tag_update_req, 2, 2);
-            _mc_bw_per_step += 2;
-            _numTagStore.inc();
+            mcdramAccess(mcdram_select, tag_update_req, 2, 2);
+            stripe.mc_bw_per_step += 2;
+            _numTagStore.inc(stripe_idx);
             uint64_t bit = (address - tag * 64) / 4;
             assert(bit < 16 && bit >= 0);
             bit = ((uint64_t) 1UL) << bit;
-            _tlb[tag].touch_bitvec |= bit;
+            tlb_entry->touch_bitvec |= bit;
             if (type == STORE)
-                _tlb[tag].dirty_bitvec |= bit;
+                tlb_entry->dirty_bitvec |= bit;
         }
         ///////////////////////////////
     }
@@ -695,37 +778,51 @@ MemoryController::access(MemReq &req) {
         /////// model counter access in mcdram
         // One counter read and one coutner write
         assert(set_num >= _ds_index);
-        _numCounterAccess.inc();
+        _numCounterAccess.inc(stripe_idx);
         MemReq counter_req = {mc_address, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState,
                               req.srcId, req.flags};
-        _mcdram[mcdram_select]->access(counter_req, 2, 2);
+        mcdramAccess(mcdram_select, counter_req, 2, 2);
         counter_req.type = PUTX;
-        _mcdram[mcdram_select]->access(counter_req, 2, 2);
-        _mc_bw_per_step += 4;
+        mcdramAccess(mcdram_select, counter_req, 2, 2);
+        stripe.mc_bw_per_step += 4;
         //////////////////////////////////////
     }
-    if (_scheme == HybridCache && _tag_buffer->getOccupancy() > 0.7) {
-        printf("[Tag Buffer FLUSH] occupancy = %f\n", _tag_buffer->getOccupancy());
-        _tag_buffer->clearTagBuffer();
-        _tag_buffer->setClearTime(req.cycle);
-        _numTagBufferFlush.inc();
+    if (_scheme == HybridCache) {
+        futex_lock(&_tag_buffer_lock);
+        if (_tag_buffer->getOccupancy() > 0.7) {
+            trace(Mem, "[Tag Buffer FLUSH] occupancy = %f", _tag_buffer->getOccupancy());
+            _tag_buffer->clearTagBuffer();
+            _tag_buffer->setClearTime(req.cycle);
+            _numTagBufferFlush.inc(stripe_idx);
+        }
+        futex_unlock(&_tag_buffer_lock);
     }
+    futex_unlock(&stripe.lock);
 
     // TODO. Make the timing info here correct.
     // TODO. should model system level stall
-    if (_scheme == HMA && _num_requests % _os_quantum == 0) {
-        uint64_t num_replace = _os_placement_policy->remapPages();
-        _numPlacement.inc(num_replace * 2);
+    if (_scheme == HMA && req_num % _os_quantum == 0) {
+        lockAllStripes();
+        remapPages(req);
+        unlockAllStripes();
     }
 
-    if (_num_requests % step_length == 0) {
-        _num_hit_per_step /= 2;
-        _num_miss_per_step /= 2;
-        _mc_bw_per_step /= 2;
-        _ext_bw_per_step /= 2;
-        if (_bw_balance && _mc_bw_per_step + _ext_bw_per_step > 0) {
+    if (req_num % step_length == 0) {
+        futex_lock(&_drain_lock);
+        lockAllStripes();
+        uint64_t mc_bw_per_step = 0;
+        uint64_t ext_bw_per_step = 0;
+        for (uint32_t i = 0; i <= _stripe_mask; i++) {
+            _stripes[i].num_hit_per_step /= 2;
+            _stripes[i].num_miss_per_step /= 2;
+            _stripes[i].mc_bw_per_step /= 2;
+            _stripes[i].ext_bw_per_step /= 2;
+            mc_bw_per_step += _stripes[i].mc_bw_per_step;
+            ext_bw_per_step += _stripes[i].ext_bw_per_step;
+        }
+        if (_bw_balance && mc_bw_per_step + ext_bw_per_step > 0) {
             // adjust _ds_index	based on mc vs. ext dram bandwidth.
-            double ratio = 1.0 * _mc_bw_per_step / (_mc_bw_per_step + _ext_bw_per_step);
+            double ratio = 1.0 * mc_bw_per_step / (mc_bw_per_step + ext_bw_per_step);
             double target_ratio = 0.8;  // because mc_bw = 4 * ext_bw
 
             // the larger the gap between ratios, the more _ds_index changes.
@@ -738,59 +835,40 @@ MemoryController::access(MemReq &req) {
             uint64_t index_step = _num_sets / 1000; // in terms of the number of sets
             int64_t delta_index = (ratio - target_ratio > -0.02 && ratio - target_ratio < 0.02) ?
                                   0 : index_step * (ratio - target_ratio) / 0.01;
-            printf("ratio = %f\n", ratio);
-            if (delta_index > 0) {
-                // _ds_index will increase. All dirty data between _ds_index and _ds_index + delta_index
-                // should be written back to external dram.
-                // For Alloy cache, this is relatively easy.
-                // For Hybrid, we need to update tag buffer as well...
-                for (uint32_t mc = 0; mc < _mcdram_per_mc; mc++) {
-                    for (uint64_t set = _ds_index; set < (uint64_t) (_ds_index + delta_index); set++) {
-                        if (set >= _num_sets) break;
-                        for (uint32_t way = 0; way < _num_ways; way++) {
-                            Way &meta = _cache[set].ways[way];
-                            if (meta.valid && meta.dirty) {
-                                // should write back to external dram.
-                                MemReq load_req = {meta.tag * 64, GETS, req.childId, &state, req.cycle, req.childLock,
-                                                   req.initialState, req.srcId, req.flags};
-                                _mcdram[mc]->access(load_req, 2, (_granularity / 64) * 4);
-                                MemReq wb_req = {meta.tag * 64, GETS, req.childId, &state, req.cycle, req.childLock,
-                                                 req.initialState, req.srcId, req.flags};
-                                _ext_dram->access(wb_req, 2, (_granularity / 64) * 4);
-                                _ext_bw_per_step += (_granularity / 64) * 4;
-                                _mc_bw_per_step += (_granularity / 64) * 4;
-                            }
-                            if (_scheme == HybridCache && meta.valid) {
-                                _tlb[meta.tag].way = _num_ways;
-                                // for Hybrid cache, should insert to tag buffer as well.
-                                if (!_tag_buffer->canInsert(meta.tag)) {
-                                    printf("Rebalance. [Tag Buffer FLUSH] occupancy = %f\n",
-                                           _tag_buffer->getOccupancy());
-                                    _tag_buffer->clearTagBuffer();
-                                    _tag_buffer->setClearTime(req.cycle);
-                                    _numTagBufferFlush.inc();
-                                }
-                                assert(_tag_buffer->canInsert(meta.tag));
-                                _tag_buffer->insert(meta.tag, true);
-                            }
-                            meta.valid = false;
-                            meta.dirty = false;
-                        }
-                        if (_scheme == HybridCache)
-                            _page_placement_policy->flushChunk(set);
-                    }
+            trace(Mem, "Rebalance: ratio = %f", ratio);
+            // Sets leaving the cache are drained incrementally (see drainSets()); until then they are
+            // still cached, so deltas accumulate on the target.
+            int64_t target = (int64_t) _ds_target + delta_index;
+            target = (target <= 0) ? 0 : ((uint64_t) target > _num_sets ? _num_sets : target);
+            bool draining = _ds_index < _ds_target;
+            if (!draining && (uint64_t) target > _ds_index)
+                _drain_start_cycle = req.cycle;
+            _ds_target = target;
+            if (_ds_target <= _ds_index) {
+                // Sets in between are already drained, and can be cached again right away
+                _ds_index = _ds_target;
+                if (draining) {
+                    _numRebalanceDrains.inc();
+                    if (req.cycle > _drain_start_cycle)
+                        _numRebalanceCycles.inc(req.cycle - _drain_start_cycle);
                 }
             }
-            _ds_index = ((int64_t) _ds_index + delta_index <= 0) ? 0 : _ds_index + delta_index;
-            printf("_ds_index = %ld/%ld\n", _ds_index, _num_sets);
+            trace(Mem, "Rebalance: _ds_index = %ld/%ld (target %ld)", _ds_index, _num_sets, _ds_target);
         }
+        unlockAllStripes();
+        futex_unlock(&_drain_lock);
+    }
+    if (_ds_index < _ds_target && futex_trylock(&_drain_lock)) {
+        // Someone else is draining otherwise; never wait for them
+        drainSets(req);
+        futex_unlock(&_drain_lock);
     }
-    futex_unlock(&_lock);
     //uint64_t latency = req.cycle - orig_cycle;
     //req.cycle = orig_cycle;
     return data_ready_cycle; //req.cycle + latency;
 }
 
+#if !MC_REPLAY
 DDRMemory *
 MemoryController::BuildDDRMemory(Config &config, uint32_t frequency,
                                  uint32_t domain, g_string name, const string &prefix, uint32_t tBL,
@@ -820,46 +898,65 @@ MemoryController::BuildDDRMemory(Config &config, uint32_t frequency,
                        timing_scale);
     return mem;
 }
+#endif
 
 void
 MemoryController::initStats(AggregateStat *parentStat) {
     AggregateStat *memStats = new AggregateStat();
     memStats->init(_name.c_str(), "Memory controller stats");
 
-    _numPlacement.init("placement", "Number of Placement");
+    _numPlacement.init("placement", "Number of Placement", getNumStripes());
     memStats->append(&_numPlacement);
-    _numCleanEviction.init("cleanEvict", "Clean Eviction");
+    _numCleanEviction.init("cleanEvict", "Clean Eviction", getNumStripes());
     memStats->append(&_numCleanEviction);
-    _numDirtyEviction.init("dirtyEvict", "Dirty Eviction");
+    _numDirtyEviction.init("dirtyEvict", "Dirty Eviction", getNumStripes());
     memStats->append(&_numDirtyEviction);
-    _numLoadHit.init("loadHit", "Load Hit");
+    _numLoadHit.init("loadHit", "Load Hit", getNumStripes());
     memStats->append(&_numLoadHit);
-    _numLoadMiss.init("loadMiss", "Load Miss");
+    _numLoadMiss.init("loadMiss", "Load Miss", getNumStripes());
     memStats->append(&_numLoadMiss);
-    _numStoreHit.init("storeHit", "Store Hit");
+    _numStoreHit.init("storeHit", "Store Hit", getNumStripes());
     memStats->append(&_numStoreHit);
-    _numStoreMiss.init("storeMiss", "Store Miss");
+    _numStoreMiss.init("storeMiss", "Store Miss", getNumStripes());
     memStats->append(&_numStoreMiss);
-    _numCounterAccess.init("counterAccess", "Counter Access");
+    _numCounterAccess.init("counterAccess", "Counter Access", getNumStripes());
     memStats->append(&_numCounterAccess);
 
-    _numTagLoad.init("tagLoad", "Number of tag loads");
+    _numTagLoad.init("tagLoad", "Number of tag loads", getNumStripes());
     memStats->append(&_numTagLoad);
-    _numTagStore.init("tagStore", "Number of tag stores");
+    _numTagStore.init("tagStore", "Number of tag stores", getNumStripes());
     memStats->append(&_numTagStore);
-    _numTagBufferFlush.init("tagBufferFlush", "Number of tag buffer flushes");
+    _numTagBufferFlush.init("tagBufferFlush", "Number of tag buffer flushes", getNumStripes());
     memStats->append(&_numTagBufferFlush);
+    _numTagBufferReject.init("tagBufferReject", "Placements skipped because the tag buffer was full",
+                             getNumStripes());
+    memStats->append(&_numTagBufferReject);
 
-    _numTBDirtyHit.init("TBDirtyHit", "Tag buffer hits (LLC dirty evict)");
+    _numTBDirtyHit.init("TBDirtyHit", "Tag buffer hits (LLC dirty evict)", getNumStripes());
     memStats->append(&_numTBDirtyHit);
-    _numTBDirtyMiss.init("TBDirtyMiss", "Tag buffer misses (LLC dirty evict)");
+    _numTBDirtyMiss.init("TBDirtyMiss", "Tag buffer misses (LLC dirty evict)", getNumStripes());
     memStats->append(&_numTBDirtyMiss);
 
-    _numTouchedLines.init("totalTouchLines", "total # of touched lines in UnisonCache");
+    _numTouchedLines.init("totalTouchLines", "total # of touched lines in UnisonCache", getNumStripes());
     memStats->append(&_numTouchedLines);
-    _numEvictedLines.init("totalEvictLines", "total # of evicted lines in UnisonCache");
+    _numEvictedLines.init("totalEvictLines", "total # of evicted lines in UnisonCache", getNumStripes());
     memStats->append(&_numEvictedLines);
 
+    _numRebalanceSets.init("rebalanceSets", "Sets drained by bandwidth rebalancing");
+    memStats->append(&_numRebalanceSets);
+    _numRebalanceWritebacks.init("rebalanceWB", "Dirty blocks written back by bandwidth rebalancing");
+    memStats->append(&_numRebalanceWritebacks);
+    _numRebalanceWBBytes.init("rebalanceWBBytes", "Bytes written back by bandwidth rebalancing");
+    memStats->append(&_numRebalanceWBBytes);
+    _numRebalanceDrains.init("rebalanceDrains", "Completed bandwidth rebalancing drains");
+    memStats->append(&_numRebalanceDrains);
+    _numRebalanceCycles.init("rebalanceCycles", "Cycles from the start to the end of rebalancing drains");
+    memStats->append(&_numRebalanceCycles);
+    auto pendingSets = [this]() { return _ds_target - _ds_index; };
+    auto pendingStat = makeLambdaStat(pendingSets);
+    pendingStat->init("rebalancePending", "Sets left to drain by bandwidth rebalancing");
+    memStats->append(pendingStat);
+
     _ext_dram->initStats(memStats);
     for (uint32_t i = 0; i < _mcdram_per_mc; i++)
         _mcdram[i]->initStats(memStats);
@@ -868,6 +965,139 @@ MemoryController::initStats(AggregateStat *parentStat) {
 }
 
 
+// Drains up to _drain_sets_per_access of the sets that rebalancing moved out of the cache: dirty data is
+// written back to external dram and, for HybridCache, the pages move to the tag buffer. The traffic is off
+// the critical path of req, whose timing record it is appended to. Caller holds the drain lock.
+void
+MemoryController::drainSets(MemReq &req) {
+    MESIState state;
+    for (uint32_t i = 0; i < _drain_sets_per_access && _ds_index < _ds_target; i++) {
+        uint64_t set = _ds_index;
+        SetStripe &set_stripe = _stripes[getStripe(set)];
+        futex_lock(&set_stripe.lock);
+        Set &meta = _cache[set];
+        for (uint32_t way = 0; way < _num_ways; way++) {
+            Address meta_tag = meta.getTag(way);
+            if (meta.isValid(way) && meta.isDirty(way)) {
+                // should write back to external dram, from the channel holding the data
+                uint32_t mc = pageChannel(meta_tag);
+                MemReq load_req = {meta_tag * 64, GETS, req.childId, &state, req.cycle, req.childLock,
+                                   req.initialState, req.srcId, req.flags};
+                mcdramAccess(mc, load_req, 2, (_granularity / 64) * 4);
+                MemReq wb_req = {meta_tag * 64, PUTX, req.childId, &state, req.cycle, req.childLock,
+                                 req.initialState, req.srcId, req.flags};
+                extDramAccess(wb_req, 2, (_granularity / 64) * 4);
+                set_stripe.ext_bw_per_step += (_granularity / 64) * 4;
+                set_stripe.mc_bw_per_step += (_granularity / 64) * 4;
+                _numRebalanceWritebacks.inc();
+                _numRebalanceWBBytes.inc(_granularity);
+            }
+            if (_scheme == HybridCache && meta.isValid(way)) {
+                set_stripe.tlb->lookup(meta_tag)->way = _num_ways;
+                // for Hybrid cache, should insert to tag buffer as well.
+                futex_lock(&_tag_buffer_lock);
+                if (!_tag_buffer->canInsert(meta_tag)) {
+                    trace(Mem, "Rebalance. [Tag Buffer FLUSH] occupancy = %f", _tag_buffer->getOccupancy());
+                    _tag_buffer->clearTagBuffer();
+                    _tag_buffer->setClearTime(req.cycle);
+                    _numTagBufferFlush.inc(getStripe(set));
+                }
+                assert(_tag_buffer->canInsert(meta_tag));
+                _tag_buffer->insert(meta_tag, true);
+                futex_unlock(&_tag_buffer_lock);
+            }
+            meta.invalidate(way);
+        }
+        if (_scheme == HybridCache)
+            _page_placement_policy->flushChunk(set);
+        _ds_index = set + 1;  // accesses to set now bypass the cache
+        futex_unlock(&set_stripe.lock);
+        _numRebalanceSets.inc();
+    }
+    if (_ds_index == _ds_target) {
+        _numRebalanceDrains.inc();
+        if (req.cycle > _drain_start_cycle)
+            _numRebalanceCycles.inc(req.cycle - _drain_start_cycle);
+    }
+}
+
+// Counters are read without the stripe and channel locks, so a record may miss the effects of the requests in
+// flight; it is a snapshot, not a consistent cut.
+void
+MemoryController::sampleTelemetry(uint64_t cycle) {
+    PackedMCTelemetryRecord rec;
+    rec.cycle = cycle;
+    rec.requests = _num_requests;
+    rec.hits = _numLoadHit.get() + _numStoreHit.get();
+    rec.misses = _numLoadMiss.get() + _numStoreMiss.get();
+    rec.mcdramBursts = 0;
+    for (uint32_t i = 0; i < _mcdram_per_mc; i++)
+        rec.mcdramBursts += _channel_locks[i].bursts;
+    rec.extBursts = _channel_locks[_mcdram_per_mc].bursts;
+    rec.placements = _numPlacement.get();
+    rec.cleanEvictions = _numCleanEviction.get();
+    rec.dirtyEvictions = _numDirtyEviction.get();
+    rec.dsIndex = _ds_index;
+    rec.dsTarget = _ds_target;
+    rec.tagBufferOccupancy = 0;
+    if (_scheme == HybridCache) {
+        futex_lock(&_tag_buffer_lock);
+        rec.tagBufferOccupancy = _tag_buffer->getOccupancy() * 1e6;
+        futex_unlock(&_tag_buffer_lock);
+    }
+    rec.pad = 0;
+    _telemetry->append(rec);
+}
+
+// Pages move in from external dram, and dirty victims move back out. Like the rebalancing writebacks, the
+// migration traffic is off the critical path of req (no system-level stall is modeled), but it occupies both
+// dram models and counts towards the bandwidth balance.
+void
+MemoryController::remapPages(MemReq &req) {
+    MESIState state;
+    uint32_t page_bursts = (_granularity / 64) * 4;
+    uint64_t num_moves = _os_placement_policy->remapPages();
+    SetStripe &stripe = _stripes[0];
+    for (const OSPlacementPolicy::PageMove &move : _os_placement_policy->getMoves()) {
+        uint32_t mc = pageChannel(move.tag);
+        MemReq load_req = {move.tag * 64, GETS, req.childId, &state, req.cycle, req.childLock, req.initialState,
+                           req.srcId, req.flags};
+        extDramAccess(load_req, 2, page_bursts);
+        MemReq fill_req = {move.tag * 64, PUTX, req.childId, &state, req.cycle, req.childLock, req.initialState,
+                           req.srcId, req.flags};
+        mcdramAccess(mc, fill_req, 2, page_bursts);
+        stripe.ext_bw_per_step += page_bursts;
+        stripe.mc_bw_per_step += page_bursts;
+        if (!move.evicted)
+            continue;
+        if (move.evicted_dirty) {
+            MemReq evict_req = {move.evicted_tag * 64, GETS, req.childId, &state, req.cycle, req.childLock,
+                                req.initialState, req.srcId, req.flags};
+            mcdramAccess(pageChannel(move.evicted_tag), evict_req, 2, page_bursts);
+            MemReq wb_req = {move.evicted_tag * 64, PUTX, req.childId, &state, req.cycle, req.childLock,
+                             req.initialState, req.srcId, req.flags};
+            extDramAccess(wb_req, 2, page_bursts);
+            stripe.ext_bw_per_step += page_bursts;
+            stripe.mc_bw_per_step += page_bursts;
+            _numDirtyEviction.inc(0);
+        } else
+            _numCleanEviction.inc(0);
+    }
+    _numPlacement.inc(0, num_moves);
+}
+
+void
+MemoryController::lockAllStripes() {
+    for (uint32_t i = 0; i <= _stripe_mask; i++)
+        futex_lock(&_stripes[i].lock);
+}
+
+void
+MemoryController::unlockAllStripes() {
+    for (uint32_t i = 0; i <= _stripe_mask; i++)
+        futex_unlock(&_stripes[i].lock);
+}
+
 Address
 MemoryController::transMCAddress(Address mc_addr) {
     // 28 lines per DRAM row (2048 KB row)
@@ -881,6 +1111,42 @@ MemoryController::transMCAddressPage(uint64_t set_num, uint32_t way_num) {
     return (_num_ways * set_num + way_num) * _granularity;
 }
 
+const uint64_t PageTable::EMPTY;
+
+PageTable::PageTable(uint64_t initial_entries, uint32_t invalid_way) {
+    uint64_t entries = 1024;
+    _shift = 64 - 10;
+    while (entries < initial_entries) {
+        entries <<= 1;
+        _shift--;
+    }
+    _mask = entries - 1;
+    _size = 0;
+    _invalid_way = invalid_way;
+    _entries = gm_memalign<TLBEntry>(CACHE_LINE_BYTES, entries);
+    for (uint64_t i = 0; i < entries; i++)
+        _entries[i].tag = EMPTY;
+}
+
+void
+PageTable::grow() {
+    TLBEntry *old_entries = _entries;
+    uint64_t old_capacity = _mask + 1;
+    _mask = 2 * old_capacity - 1;
+    _shift--;
+    _entries = gm_memalign<TLBEntry>(CACHE_LINE_BYTES, _mask + 1);
+    for (uint64_t i = 0; i <= _mask; i++)
+        _entries[i].tag = EMPTY;
+    for (uint64_t j = 0; j < old_capacity; j++) {
+        if (old_entries[j].tag == EMPTY) continue;
+        uint64_t i = hash(old_entries[j].tag);
+        while (_entries[i].tag != EMPTY)
+            i = (i + 1) & _mask;
+        _entries[i] = old_entries[j];
+    }
+    gm_free(old_entries);
+}
+
 TagBuffer::TagBuffer(Config &config) {
     uint32_t tb_size = config.get<uint32_t>("sys.mem.mcdram.tag_buffer_size", 1024);
     _num_ways = 8;
@@ -912,13 +1178,15 @@ TagBuffer::existInTB(Address tag) {
 
 bool
 TagBuffer::canInsert(Address tag) {
-#if 1
+#if CHECK_LEVEL >= CHECK_EXHAUSTIVE
     uint32_t num = 0;
     for (uint32_t i = 0; i < _num_sets; i++)
         for (uint32_t j = 0; j < _num_ways; j++)
             if (_tag_buffer[i][j].remap)
                 num++;
     assert(num == _entry_occupied);
+#elif CHECK_LEVEL >= CHECK_CHEAP
+    assert(_entry_occupied <= _num_sets * _num_ways);
 #endif
 
     uint32_t set_num = tag % _num_sets;
@@ -930,6 +1198,23 @@ TagBuffer::canInsert(Address tag) {
     return false;
 }
 
+bool
+MemoryController::tryRemapInTagBuffer(uint64_t set_num, Address tag, Address victim_tag) {
+    futex_lock(&_tag_buffer_lock);
+    bool inserted = _tag_buffer->tryInsertPair(tag, victim_tag);
+    futex_unlock(&_tag_buffer_lock);
+    if (!inserted) _numTagBufferReject.inc(getStripe(set_num));
+    return inserted;
+}
+
+bool
+TagBuffer::tryInsertPair(Address tag1, Address tag2) {
+    if (!canInsert(tag1, tag2)) return false;
+    insert(tag1, true);
+    insert(tag2, true);
+    return true;
+}
+
 bool
 TagBuffer::canInsert(Address tag1, Address tag2) {
     uint32_t set_num1 = tag1 % _num_sets;
@@ -951,7 +1236,7 @@ void
 TagBuffer::insert(Address tag, bool remap) {
     uint32_t set_num = tag % _num_sets;
     uint32_t exist_way = existInTB(tag);
-#if 1
+#if CHECK_LEVEL >= CHECK_EXHAUSTIVE
     for (uint32_t i = 0; i < _num_ways; i++)
         for (uint32_t j = i + 1; j < _num_ways; j++) {
             //if (_tag_buffer[set_num][i].tag != 0 && _tag_buffer[set_num][i].tag == _tag_buffer[set_num][j].tag) {
@@ -962,6 +1247,10 @@ TagBuffer::insert(Address tag, bool remap) {
             assert(_tag_buffer[set_num][i].tag != _tag_buffer[set_num][j].tag
                    || _tag_buffer[set_num][i].tag == 0);
         }
+#elif CHECK_LEVEL >= CHECK_CHEAP
+    // existInTB returns the first match, so the tag must not appear again
+    for (uint32_t i = exist_way + 1; i < _num_ways; i++)
+        assert(_tag_buffer[set_num][i].tag != tag || tag == 0);
 #endif
     if (exist_way < _num_ways) {
         // the tag already exists in the Tag Buffer
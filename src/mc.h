@@ -1,9 +1,12 @@
 #ifndef _MC_H_
 #define _MC_H_
 
+#include <emmintrin.h>
 #include "config.h"
 #include "g_std/g_string.h"
+#include "locks.h"
 #include "memory_hierarchy.h"
+#include "pad.h"
 #include <string>
 #include "stats.h"
 #include "g_std/g_unordered_map.h"
@@ -15,6 +18,18 @@ using namespace std;
 
 #define MAX_STEPS 10000
 
+// MemoryController request tracing (sys.mem.enableTrace, see mc_tracing.h).
+// Build with -DMC_TRACE=0 to compile it out of the access path entirely.
+#ifndef MC_TRACE
+#define MC_TRACE 1
+#endif
+
+// Set when building mcreplay, the trace-driven simulator: it has no weave-phase
+// timing models, so DDR and DRAMSim DRAM types are not available.
+#ifndef MC_REPLAY
+#define MC_REPLAY 0
+#endif
+
 enum ReqType {
     LOAD = 0,
     STORE
@@ -30,26 +45,65 @@ enum Scheme {
     Tagless
 };
 
-class Way {
-public:
-    Address tag;
-    bool valid;
-    bool dirty;
-};
-
+// Functional model of one DRAM cache set. The sets of a controller share a
+// structure-of-arrays tag store: contiguous tags, plus valid and dirty
+// bitmasks (one bit per way), so way searches scan packed tags and use
+// bit scans instead of walking per-way records.
 class Set {
 public:
-    Way *ways;
+    Address *tags;
+    uint64_t *valid_bits;  // bits past num_ways are set, so they never look empty
+    uint64_t *dirty_bits;
     uint32_t num_ways;
 
-    uint32_t getEmptyWay() {
-        for (uint32_t i = 0; i < num_ways; i++)
-            if (!ways[i].valid)
-                return i;
+    inline bool isValid(uint32_t way) const { return (valid_bits[way / 64] >> (way % 64)) & 1; }
+
+    inline bool isDirty(uint32_t way) const { return (dirty_bits[way / 64] >> (way % 64)) & 1; }
+
+    inline Address getTag(uint32_t way) const { return tags[way]; }
+
+    inline void fill(uint32_t way, Address tag, bool dirty) {
+        tags[way] = tag;
+        valid_bits[way / 64] |= 1ul << (way % 64);
+        if (dirty) dirty_bits[way / 64] |= 1ul << (way % 64);
+        else dirty_bits[way / 64] &= ~(1ul << (way % 64));
+    }
+
+    inline void setDirty(uint32_t way) { dirty_bits[way / 64] |= 1ul << (way % 64); }
+
+    inline void invalidate(uint32_t way) {
+        valid_bits[way / 64] &= ~(1ul << (way % 64));
+        dirty_bits[way / 64] &= ~(1ul << (way % 64));
+    }
+
+    uint32_t getEmptyWay() const {
+        for (uint32_t w = 0; w < (num_ways + 63) / 64; w++)
+            if (~valid_bits[w])
+                return w * 64 + __builtin_ctzl(~valid_bits[w]);
         return num_ways;
     };
 
-    bool hasEmptyWay() { return getEmptyWay() < num_ways; };
+    bool hasEmptyWay() const { return getEmptyWay() < num_ways; };
+
+    // Returns the valid way holding tag, or num_ways. Compares 4 tags per
+    // iteration with SSE2 (we build for core2, which has no 64-bit compare, so
+    // 64-bit equality is the AND of both 32-bit halves).
+    inline uint32_t findTag(Address tag) const {
+        const __m128i key = _mm_set1_epi64x(tag);
+        uint32_t w = 0;
+        for (; w + 4 <= num_ways; w += 4) {
+            __m128i c0 = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&tags[w])), key);
+            __m128i c1 = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&tags[w + 2])), key);
+            c0 = _mm_and_si128(c0, _mm_shuffle_epi32(c0, _MM_SHUFFLE(2, 3, 0, 1)));
+            c1 = _mm_and_si128(c1, _mm_shuffle_epi32(c1, _MM_SHUFFLE(2, 3, 0, 1)));
+            if (likely(_mm_movemask_epi8(_mm_or_si128(c0, c1)) == 0)) continue;
+            for (uint32_t i = w; i < w + 4; i++)
+                if (tags[i] == tag && isValid(i)) return i;
+        }
+        for (; w < num_ways; w++)
+            if (tags[w] == tag && isValid(w)) return w;
+        return num_ways;
+    }
 };
 
 // Not modeling all details of the tag buffer. 
@@ -76,6 +130,9 @@ public:
 
     void insert(Address tag, bool remap);
 
+    // Inserts both tags (remapped) if there is room for both, otherwise leaves the tag buffer untouched.
+    bool tryInsertPair(Address tag1, Address tag2);
+
     double getOccupancy() { return 1.0 * _entry_occupied / _num_ways / _num_sets; };
 
     void clearTagBuffer();
@@ -96,16 +153,128 @@ private:
 class TLBEntry {
 public:
     uint64_t tag;
-    uint64_t way;
-    uint64_t count; // for OS based placement policy
+    uint32_t way;
+    // for OS based placement policy: saturating access count, decayed lazily (see OSPlacementPolicy)
+    uint16_t count;
+    uint16_t epoch;  // of the last count update
 
     // the following two are only for UnisonCache
     // due to space cosntraint, it is not feasible to keep one bit for each line,
     // so we use 1 bit for 4 lines.
     uint64_t touch_bitvec; // whether a line is touched in a page
     uint64_t dirty_bitvec; // whether a line is dirty in page
+};  // 32 bytes, 2 entries per cache line
+
+// Page metadata table (the "TLB" of page-granularity schemes). Flat open-addressing
+// hash table with linear probing: one probe sequence per lookup, entries stored
+// inline in a single bulk-allocated array that doubles when 3/4 full.
+class PageTable : public GlobAlloc {
+private:
+    TLBEntry *_entries;
+    uint64_t _mask;  // capacity - 1
+    uint32_t _shift;  // 64 - log2(capacity)
+    uint64_t _size;
+    uint32_t _invalid_way;  // way of pages not in the DRAM cache
+
+    static const uint64_t EMPTY = (uint64_t) -1L;  // never a valid tag
+
+    inline uint64_t hash(Address tag) const {
+        // Tags are dense page numbers; Fibonacci hashing spreads them over the table
+        return (tag * 0x9E3779B97F4A7C15ull) >> _shift;
+    }
+
+    void grow();
+
+public:
+    PageTable(uint64_t initial_entries, uint32_t invalid_way);
+
+    // nullptr if the page has never been accessed
+    inline TLBEntry *lookup(Address tag) {
+        for (uint64_t i = hash(tag);; i = (i + 1) & _mask) {
+            if (_entries[i].tag == tag) return &_entries[i];
+            if (_entries[i].tag == EMPTY) return nullptr;
+        }
+    }
+
+    // Inserts the page if needed. Only insertions move entries, so the returned
+    // pointer is valid until the next get() of a different page.
+    inline TLBEntry *get(Address tag) {
+        assert(tag != EMPTY);
+        uint64_t i = hash(tag);
+        for (;; i = (i + 1) & _mask) {
+            if (_entries[i].tag == tag) return &_entries[i];
+            if (_entries[i].tag == EMPTY) break;
+        }
+        if (unlikely(4 * (_size + 1) > 3 * (_mask + 1))) {
+            grow();
+            return get(tag);
+        }
+        _entries[i] = TLBEntry {tag, _invalid_way, 0, 0, 0, 0};
+        _size++;
+        return &_entries[i];
+    }
+
+    uint64_t size() const { return _size; }
+
+    template<typename F>
+    void forEach(F f) {
+        for (uint64_t i = 0; i <= _mask; i++)
+            if (_entries[i].tag != EMPTY) f(_entries[i]);
+    }
 };
 
+// Counter with one slot per set stripe of a MemoryController (see SetStripe), each
+// on its own cache line. A slot is only updated by the holder of its stripe's lock,
+// so accesses to different stripes never share counter lines.
+class StripedCounter : public ScalarStat {
+private:
+    static const uint32_t STRIDE = CACHE_LINE_BYTES / sizeof(uint64_t);
+    uint64_t *_slots;
+    uint32_t _num_slots;
+
+public:
+    StripedCounter() : ScalarStat(), _slots(nullptr), _num_slots(0) {}
+
+    void init(const char *name, const char *desc, uint32_t num_slots) {
+        initStat(name, desc);
+        _num_slots = num_slots;
+        _slots = gm_memalign<uint64_t>(CACHE_LINE_BYTES, num_slots * STRIDE);
+        for (uint32_t i = 0; i < num_slots * STRIDE; i++) _slots[i] = 0;
+    }
+
+    inline void inc(uint32_t slot, uint64_t delta = 1) {
+        _slots[slot * STRIDE] += delta;
+    }
+
+    // For updates made without holding the slot's stripe lock
+    inline void atomicInc(uint32_t slot, uint64_t delta = 1) {
+        __sync_fetch_and_add(&_slots[slot * STRIDE], delta);
+    }
+
+    uint64_t get() const {
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i < _num_slots; i++) sum += _slots[i * STRIDE];
+        return sum;
+    }
+};
+
+// A MemoryController interleaves its sets over a power-of-2 number of stripes (set_num
+// % stripes). The stripe lock protects the functional state of its sets (tags, page table
+// entries, placement metadata), so accesses to different stripes proceed in parallel.
+// Operations that span sets (BATMAN rebalancing, HMA remapping) take all stripe locks.
+struct SetStripe {
+    lock_t lock;
+    PageTable *tlb;  // pages mapping to the stripe's sets; page-granularity schemes only
+    // Recent behavior, decayed every step (see MemoryController::access)
+    uint64_t num_hit_per_step;
+    uint64_t num_miss_per_step;
+    uint64_t mc_bw_per_step;
+    uint64_t ext_bw_per_step;
+} ATTR_LINE_ALIGNED;
+
+class MCTraceWriter;
+class MCTelemetryWriter;
+
 class LinePlacementPolicy;
 
 class PagePlacementPolicy;
@@ -124,15 +293,14 @@ private:
     g_string _name;
 
     // Trace related code
-    lock_t _lock;
     bool _collect_trace;
+    MCTraceWriter *_trace_writer;  // nullptr if this controller is not traced
 
-    //Kasraa begin
-    g_string myTracePath;
-    uint64_t maximumTraceLines;
-    uint64_t myTraceCurrentLength;
-    FILE *f;
-    //Kasraa end
+    // Telemetry time series (sys.mem.telemetryInterval, see mc_telemetry.h)
+    MCTelemetryWriter *_telemetry;  // nullptr if disabled
+    uint64_t _telemetry_interval;
+    volatile uint64_t _telemetry_next_cycle;
+    lock_t _telemetry_lock;  // taken with no other lock held
 
     // External Dram Configuration
     MemObject *_ext_dram;
@@ -149,16 +317,29 @@ public:
 
     uint32_t getNumWays() { return _num_ways; };
 
-    double getRecentMissRate() { return (double) _num_miss_per_step / (_num_miss_per_step + _num_hit_per_step); };
+    uint32_t getNumStripes() { return _stripe_mask + 1; };
+
+    uint32_t getStripe(uint64_t set_num) { return set_num & _stripe_mask; };
+
+    // Miss rate of the stripe holding set_num
+    double getRecentMissRate(uint64_t set_num) {
+        SetStripe &stripe = _stripes[getStripe(set_num)];
+        return (double) stripe.num_miss_per_step / (stripe.num_miss_per_step + stripe.num_hit_per_step);
+    };
 
     Scheme getScheme() { return _scheme; };
 
     Set *getSets() { return _cache; };
 
-    g_unordered_map<Address, TLBEntry> *getTLB() { return &_tlb; };
+    PageTable *getTLB(uint64_t set_num) { return _stripes[getStripe(set_num)].tlb; };
 
     TagBuffer *getTagBuffer() { return _tag_buffer; };
 
+    // HybridCache: records the remapping of tag into victim_tag's way in the tag buffer, checking and inserting
+    // in one critical section. Returns false, and counts a rejected placement, if the tag buffer has no room.
+    // Caller holds the stripe lock of set_num.
+    bool tryRemapInTagBuffer(uint64_t set_num, Address tag, Address victim_tag);
+
     uint64_t getGranularity() { return _granularity; };
 
 private:
@@ -168,6 +349,39 @@ private:
     // For Page Granularity Cache
     Address transMCAddressPage(uint64_t set_num, uint32_t way_num);
 
+    // DRAM timing model accesses. Each channel (mcdram channels, then ext dram) has its own lock.
+    inline uint64_t mcdramAccess(uint32_t channel, MemReq &req, int type, uint32_t data_size) {
+        futex_lock(&_channel_locks[channel].lock);
+        uint64_t resp_cycle = _mcdram[channel]->access(req, type, data_size);
+        _channel_locks[channel].bursts += data_size;
+        futex_unlock(&_channel_locks[channel].lock);
+        return resp_cycle;
+    }
+
+    // mcdram channel holding a page (or line, for line granularity schemes)
+    inline uint32_t pageChannel(Address tag) { return (tag * (_granularity / 64) / 64) % _mcdram_per_mc; }
+
+    inline uint64_t extDramAccess(MemReq &req, int type, uint32_t data_size) {
+        futex_lock(&_channel_locks[_mcdram_per_mc].lock);
+        uint64_t resp_cycle = _ext_dram->access(req, type, data_size);
+        _channel_locks[_mcdram_per_mc].bursts += data_size;
+        futex_unlock(&_channel_locks[_mcdram_per_mc].lock);
+        return resp_cycle;
+    }
+
+    // Locks all set stripes, in order, for operations that span sets
+    void lockAllStripes();
+
+    void unlockAllStripes();
+
+    void drainSets(MemReq &req);
+
+    // Appends a telemetry record. Caller holds the telemetry lock.
+    void sampleTelemetry(uint64_t cycle);
+
+    // HMA: runs the OS page remapping and charges the migration traffic. Caller holds all stripe locks.
+    void remapPages(MemReq &req);
+
     // For Tagless.
     // For Tagless, we don't use "Set * _cache;" as other schemes. Instead, we use the following
     // structure to model a fully associative cache with FIFO replacement
@@ -184,9 +398,19 @@ private:
     LinePlacementPolicy *_line_placement_policy;
     PagePlacementPolicy *_page_placement_policy;
     OSPlacementPolicy *_os_placement_policy;
-    uint64_t _num_requests;
+    volatile uint64_t _num_requests;
     Scheme _scheme;
     TagBuffer *_tag_buffer;
+    lock_t _tag_buffer_lock;  // taken after a stripe lock, never while accessing a channel
+
+    // Locking (see SetStripe)
+    SetStripe *_stripes;
+    uint32_t _stripe_mask;
+    struct ChannelLock {
+        lock_t lock;
+        uint64_t bursts;  // all accesses to the channel, for telemetry
+    } ATTR_LINE_ALIGNED;
+    ChannelLock *_channel_locks;
 
     // For HybridCache
     uint32_t _footprint_size;
@@ -194,36 +418,45 @@ private:
     // Balance in- and off-package DRAM bandwidth.
     // From "BATMAN: Maximizing Bandwidth Utilization of Hybrid Memory Systems"
     bool _bw_balance;
-    uint64_t _ds_index;
-
-    // TLB Hack
-    g_unordered_map<Address, TLBEntry> _tlb;
-    uint64_t _os_quantum;
-
-    // Stats
-    Counter _numPlacement;
-    Counter _numCleanEviction;
-    Counter _numDirtyEviction;
-    Counter _numLoadHit;
-    Counter _numLoadMiss;
-    Counter _numStoreHit;
-    Counter _numStoreMiss;
-    Counter _numCounterAccess; // for FBR placement policy
-
-    Counter _numTagLoad;
-    Counter _numTagStore;
+    // Sets below _ds_index bypass the cache. When rebalancing raises it, the sets up to _ds_target
+    // are drained a few per access (drainSets), and _ds_index follows. It only changes under the
+    // drain lock plus the lock of the stripe(s) whose sets change sides.
+    volatile uint64_t _ds_index;
+    uint64_t _ds_target;
+    uint32_t _drain_sets_per_access;
+    uint64_t _drain_start_cycle;
+    lock_t _drain_lock;  // taken before stripe locks
+
+    // TLB Hack (the page tables live in the set stripes)
+    uint64_t _os_quantum;  // HMA: requests between page remappings
+
+    // Stats, one slot per set stripe
+    StripedCounter _numPlacement;
+    StripedCounter _numCleanEviction;
+    StripedCounter _numDirtyEviction;
+    StripedCounter _numLoadHit;
+    StripedCounter _numLoadMiss;
+    StripedCounter _numStoreHit;
+    StripedCounter _numStoreMiss;
+    StripedCounter _numCounterAccess; // for FBR placement policy
+
+    StripedCounter _numTagLoad;
+    StripedCounter _numTagStore;
     // For HybridCache
-    Counter _numTagBufferFlush;
-    Counter _numTBDirtyHit;
-    Counter _numTBDirtyMiss;
+    StripedCounter _numTagBufferFlush;
+    StripedCounter _numTagBufferReject;
+    StripedCounter _numTBDirtyHit;
+    StripedCounter _numTBDirtyMiss;
     // For UnisonCache
-    Counter _numTouchedLines;
-    Counter _numEvictedLines;
+    StripedCounter _numTouchedLines;
+    StripedCounter _numEvictedLines;
+    // For bandwidth rebalancing, only updated under the drain lock
+    Counter _numRebalanceSets;
+    Counter _numRebalanceWritebacks;
+    Counter _numRebalanceWBBytes;
+    Counter _numRebalanceDrains;
+    Counter _numRebalanceCycles;
 
-    uint64_t _num_hit_per_step;
-    uint64_t _num_miss_per_step;
-    uint64_t _mc_bw_per_step;
-    uint64_t _ext_bw_per_step;
     double _miss_rate_trace[MAX_STEPS];
 
     uint32_t _num_steps;
@@ -0,0 +1,41 @@
+#include "mc_telemetry.h"
+
+MCTelemetryWriter::MCTelemetryWriter(const g_string &_fname, uint64_t _interval, uint64_t _numSets)
+        : fname(_fname) {
+    written = 0;
+    interval = _interval;
+    numSets = _numSets;
+    ownerPid = getpid();
+    fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) panic("Could not create MC telemetry %s", fname.c_str());
+    writeHeader(MC_TELEMETRY_UNFINISHED);
+}
+
+void MCTelemetryWriter::writeHeader(uint64_t numRecords) {
+    MCTelemetryHeader hdr = {MC_TELEMETRY_MAGIC, MC_TELEMETRY_VERSION, sizeof(PackedMCTelemetryRecord), numRecords,
+                             interval, numSets};
+    if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) panic("Could not write MC telemetry header to %s", fname.c_str());
+}
+
+void MCTelemetryWriter::flush() {
+    const char *data = reinterpret_cast<const char *>(buf.data());
+    size_t bytes = buf.size() * sizeof(PackedMCTelemetryRecord);
+    off_t offset = sizeof(MCTelemetryHeader) + written * sizeof(PackedMCTelemetryRecord);
+    while (bytes) {
+        ssize_t res = pwrite(fd, data, bytes, offset);
+        if (res <= 0) panic("Write to MC telemetry %s failed", fname.c_str());
+        data += res;
+        bytes -= res;
+        offset += res;
+    }
+    written += buf.size();
+    buf.clear();
+}
+
+void MCTelemetryWriter::finish() {
+    assert(getpid() == ownerPid);
+    flush();
+    writeHeader(written);
+    close(fd);
+    info("Finished MC telemetry %s, %ld records", fname.c_str(), written);
+}
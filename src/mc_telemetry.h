@@ -0,0 +1,142 @@
+#ifndef MC_TELEMETRY_H_
+#define MC_TELEMETRY_H_
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "g_std/g_string.h"
+#include "g_std/g_vector.h"
+#include "galloc.h"
+#include "log.h"
+
+/* Time series of DRAM cache behavior, one record per MemoryController every
+ * sys.mem.telemetryInterval cycles (see MemoryController::sampleTelemetry).
+ *
+ * Counters are cumulative, so consumers take deltas between consecutive
+ * records to get per-interval hit rates and bandwidths; a record is taken by
+ * the first request past each interval boundary, so intervals with no
+ * requests have no record. Use dumpmctelemetry to print a file as TSV.
+ */
+
+#define MC_TELEMETRY_MAGIC 0x31304c4554434d5aull  // "ZMCTEL01"
+#define MC_TELEMETRY_VERSION 1
+#define MC_TELEMETRY_UNFINISHED ((uint64_t)-1L)
+
+struct PackedMCTelemetryRecord {
+    uint64_t cycle;
+    uint64_t requests;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t mcdramBursts;  // 16-byte bursts, all mcdram channels
+    uint64_t extBursts;
+    uint64_t placements;
+    uint64_t cleanEvictions;
+    uint64_t dirtyEvictions;
+    uint64_t dsIndex;  // bandwidth balancing: sets below dsIndex bypass the cache
+    uint64_t dsTarget;
+    uint32_t tagBufferOccupancy;  // parts per million; 0 without a tag buffer
+    uint32_t pad;
+};  // 96 bytes --> no packing needed
+
+struct MCTelemetryHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t numRecords;  // MC_TELEMETRY_UNFINISHED until the writer closes the file
+    uint64_t interval;  // cycles
+    uint64_t numSets;  // for dsIndex/dsTarget
+};
+
+/* Memory-mapped, read-only view of a telemetry file */
+class MCTelemetryReader {
+private:
+    const MCTelemetryHeader *header;
+    const PackedMCTelemetryRecord *recs;
+    uint64_t numRecords;
+    size_t mapSize;
+
+public:
+    explicit MCTelemetryReader(const char *fname) {
+        int fd = open(fname, O_RDONLY);
+        if (fd == -1) panic("Could not open MC telemetry %s", fname);
+        struct stat st;
+        if (fstat(fd, &st)) panic("Could not stat MC telemetry %s", fname);
+        mapSize = st.st_size;
+        if (mapSize < sizeof(MCTelemetryHeader)) panic("MC telemetry %s is truncated", fname);
+
+        void *map = mmap(nullptr, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) panic("Could not mmap MC telemetry %s", fname);
+        close(fd);
+
+        header = static_cast<const MCTelemetryHeader *>(map);
+        if (header->magic != MC_TELEMETRY_MAGIC) panic("%s is not an MC telemetry file", fname);
+        if (header->version != MC_TELEMETRY_VERSION || header->recordSize != sizeof(PackedMCTelemetryRecord)) {
+            panic("MC telemetry %s has version %d / record size %d, expected %d / %ld", fname, header->version,
+                  header->recordSize, MC_TELEMETRY_VERSION, sizeof(PackedMCTelemetryRecord));
+        }
+        recs = reinterpret_cast<const PackedMCTelemetryRecord *>(header + 1);
+
+        uint64_t fileRecords = (mapSize - sizeof(MCTelemetryHeader)) / sizeof(PackedMCTelemetryRecord);
+        if (header->numRecords == MC_TELEMETRY_UNFINISHED) {
+            warn("MC telemetry %s unfinished (halted simulation?), using the %ld complete records", fname,
+                 fileRecords);
+            numRecords = fileRecords;
+        } else {
+            assert_msg(header->numRecords <= fileRecords, "MC telemetry %s: header says %ld records, file has %ld",
+                       fname, header->numRecords, fileRecords);
+            numRecords = header->numRecords;
+        }
+    }
+
+    ~MCTelemetryReader() {
+        munmap(const_cast<MCTelemetryHeader *>(header), mapSize);
+    }
+
+    uint64_t getNumRecords() const { return numRecords; }
+
+    uint64_t getInterval() const { return header->interval; }
+
+    uint64_t getNumSets() const { return header->numSets; }
+
+    const PackedMCTelemetryRecord *begin() const { return recs; }
+
+    const PackedMCTelemetryRecord *end() const { return recs + numRecords; }
+};
+
+/* Appends records to a telemetry file. Not thread-safe; the controller
+ * serializes appends. Records are few (one per interval), so they are
+ * buffered in the global heap and written out in chunks by the process that
+ * created the file (other processes do not share its fd, and leave their
+ * records to it).
+ */
+class MCTelemetryWriter : public GlobAlloc {
+private:
+    g_vector<PackedMCTelemetryRecord> buf;
+    uint64_t written;
+    uint64_t interval;
+    uint64_t numSets;
+    int fd;
+    pid_t ownerPid;
+    g_string fname;
+
+public:
+    MCTelemetryWriter(const g_string &fname, uint64_t interval, uint64_t numSets);
+
+    inline void append(const PackedMCTelemetryRecord &rec) {
+        buf.push_back(rec);
+        if (unlikely(buf.size() >= 4096) && getpid() == ownerPid) flush();
+    }
+
+    // Writes out all records and closes the file. Must be called by the process that created the writer,
+    // once no more records will be appended (i.e., at termination).
+    void finish();
+
+private:
+    void flush();
+
+    void writeHeader(uint64_t numRecords);
+};
+
+#endif  // MC_TELEMETRY_H_
@@ -0,0 +1,122 @@
+#include "mc_tracing.h"
+#include "bithacks.h"
+#include "pin.H"
+
+#define MC_TRACE_CHUNK (64 * 1024u)  // records per write() (2MB)
+
+MCTraceWriter::MCTraceWriter(const g_string &_fname, uint32_t _numRings, uint32_t ringEntries, uint64_t _maxRecords)
+        : fname(_fname) {
+    numRings = MAX(_numRings, 1u);
+    uint32_t entries = 1;
+    while (entries < ringEntries) entries <<= 1;
+    ringMask = entries - 1;
+    lastRing = 0;
+
+    rings = gm_memalign<Ring>(CACHE_LINE_BYTES, numRings);
+    for (uint32_t i = 0; i < numRings; i++) {
+        rings[i].slots = gm_memalign<Slot>(CACHE_LINE_BYTES, entries);
+        rings[i].head = 0;
+        rings[i].tail = 0;
+    }
+    nextSeq = 0;
+
+    outBuf = gm_calloc<PackedMCTraceRecord>(MC_TRACE_CHUNK);
+    outCur = 0;
+    outMax = MC_TRACE_CHUNK;
+    written = 0;
+    maxRecords = _maxRecords;
+
+    fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) panic("Could not create MC trace %s", fname.c_str());
+    MCTraceHeader hdr = {MC_TRACE_MAGIC, MC_TRACE_VERSION, sizeof(PackedMCTraceRecord), MC_TRACE_UNFINISHED};
+    if (::write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) panic("Could not write MC trace header to %s", fname.c_str());
+
+    terminate = false;
+    done = false;
+    __sync_synchronize();
+    PIN_SpawnInternalThread(WriterThreadTrampoline, this, 64 * 1024, nullptr);
+}
+
+void MCTraceWriter::WriterThreadTrampoline(void *arg) {
+    static_cast<MCTraceWriter *>(arg)->writerLoop();
+}
+
+void MCTraceWriter::writerLoop() {
+    info("Started MC trace writer thread (%s, %d rings of %d records)", fname.c_str(), numRings, ringMask + 1);
+    while (true) {
+        bool term = terminate;  // read before draining, so that we see everything published before the flag
+        __sync_synchronize();
+        bool progress = drain();
+        if (term && !progress) break;
+        if (!progress) usleep(1000);
+    }
+
+    uint64_t lost = 0;
+    for (uint32_t i = 0; i < numRings; i++) lost += rings[i].head - rings[i].tail;
+    if (lost) warn("MC trace %s has a gap at record %ld, dropping %ld records", fname.c_str(), written, lost);
+
+    flushOut();
+    MCTraceHeader hdr = {MC_TRACE_MAGIC, MC_TRACE_VERSION, sizeof(PackedMCTraceRecord), written};
+    if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) panic("Could not finalize MC trace %s", fname.c_str());
+    close(fd);
+    info("Finished MC trace %s, %ld records", fname.c_str(), written);
+
+    __sync_synchronize();
+    done = true;
+}
+
+// Merges records into seq order. Each ring is seq-ordered and seqs are dense, so the next record is always at the
+// tail of some ring (or not published yet). Returns true if it wrote anything.
+bool MCTraceWriter::drain() {
+    bool progress = false;
+    uint32_t misses = 0;
+    uint32_t r = lastRing;
+    while (misses < numRings && written < maxRecords) {
+        Ring &ring = rings[r];
+        uint64_t head = ring.head;
+        __sync_synchronize();  // read slots after head
+        uint64_t tail = ring.tail;
+        if (tail == head || ring.slots[tail & ringMask].seq != written) {
+            r = (r + 1 == numRings) ? 0 : r + 1;
+            misses++;
+            continue;
+        }
+
+        do {
+            outBuf[outCur++] = ring.slots[tail & ringMask].rec;
+            tail++;
+            written++;
+            if (unlikely(outCur == outMax)) {
+                ring.tail = tail;
+                flushOut();
+            }
+        } while (tail != head && ring.slots[tail & ringMask].seq == written);
+        __sync_synchronize();  // done reading slots before releasing them
+        ring.tail = tail;
+        misses = 0;
+        progress = true;
+
+        if (unlikely(written == maxRecords)) info("We reached the maximum size of MC trace %s!", fname.c_str());
+    }
+    lastRing = r;
+    return progress;
+}
+
+void MCTraceWriter::flushOut() {
+    const char *buf = reinterpret_cast<const char *>(outBuf);
+    size_t bytes = outCur * sizeof(PackedMCTraceRecord);
+    while (bytes) {
+        ssize_t res = ::write(fd, buf, bytes);
+        if (res <= 0) panic("Write to MC trace %s failed", fname.c_str());
+        buf += res;
+        bytes -= res;
+    }
+    outCur = 0;
+}
+
+void MCTraceWriter::finish() {
+    assert(!terminate);
+    terminate = true;
+    __sync_synchronize();
+    while (!done) usleep(1000);
+}
@@ -0,0 +1,178 @@
+#ifndef MC_TRACING_H_
+#define MC_TRACING_H_
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "g_std/g_string.h"
+#include "galloc.h"
+#include "log.h"
+#include "pad.h"
+
+/* Binary request traces of the MemoryController (the LLC miss stream).
+ *
+ * Each request is a fixed-width record. Simulation threads append records to
+ * per-thread rings in the global heap, without holding the controller lock,
+ * and a background writer thread merges the rings back into arrival order and
+ * writes them out in large sequential chunks. Use dumpmctrace to turn a trace
+ * into the old pc/lineAddr/dirty/srcId TSV.
+ */
+
+#define MC_TRACE_MAGIC 0x3130524354434d5aull  // "ZMCTRC01"
+#define MC_TRACE_VERSION 1
+#define MC_TRACE_UNFINISHED ((uint64_t)-1L)
+
+struct PackedMCTraceRecord {
+    uint64_t pc;
+    uint64_t lineAddr;
+    uint64_t cycle;
+    uint32_t srcId;
+    uint32_t dirty;  // 1 for PUTX (LLC dirty writeback)
+};  // 32 bytes --> no packing needed
+
+struct MCTraceHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t numRecords;  // MC_TRACE_UNFINISHED until the writer closes the file
+};
+
+/* Memory-mapped, read-only view of a trace. Many readers (e.g., replay
+ * threads) can share one instance.
+ */
+class MCTraceReader {
+private:
+    const MCTraceHeader *header;
+    const PackedMCTraceRecord *recs;
+    uint64_t numRecords;
+    size_t mapSize;
+
+public:
+    explicit MCTraceReader(const char *fname) {
+        int fd = open(fname, O_RDONLY);
+        if (fd == -1) panic("Could not open MC trace %s", fname);
+        struct stat st;
+        if (fstat(fd, &st)) panic("Could not stat MC trace %s", fname);
+        mapSize = st.st_size;
+        if (mapSize < sizeof(MCTraceHeader)) panic("MC trace %s is truncated", fname);
+
+        void *map = mmap(nullptr, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) panic("Could not mmap MC trace %s", fname);
+        close(fd);
+        madvise(map, mapSize, MADV_SEQUENTIAL);
+
+        header = static_cast<const MCTraceHeader *>(map);
+        if (header->magic != MC_TRACE_MAGIC) panic("%s is not an MC trace", fname);
+        if (header->version != MC_TRACE_VERSION || header->recordSize != sizeof(PackedMCTraceRecord)) {
+            panic("MC trace %s has version %d / record size %d, expected %d / %ld", fname, header->version,
+                  header->recordSize, MC_TRACE_VERSION, sizeof(PackedMCTraceRecord));
+        }
+        recs = reinterpret_cast<const PackedMCTraceRecord *>(header + 1);
+
+        uint64_t fileRecords = (mapSize - sizeof(MCTraceHeader)) / sizeof(PackedMCTraceRecord);
+        if (header->numRecords == MC_TRACE_UNFINISHED) {
+            warn("MC trace %s unfinished (halted simulation?), using the %ld complete records", fname, fileRecords);
+            numRecords = fileRecords;
+        } else {
+            assert_msg(header->numRecords <= fileRecords, "MC trace %s: header says %ld records, file has %ld",
+                       fname, header->numRecords, fileRecords);
+            numRecords = header->numRecords;
+        }
+    }
+
+    ~MCTraceReader() {
+        munmap(const_cast<MCTraceHeader *>(header), mapSize);
+    }
+
+    uint64_t getNumRecords() const { return numRecords; }
+
+    inline const PackedMCTraceRecord &get(uint64_t idx) const {
+        assert(idx < numRecords);
+        return recs[idx];
+    }
+
+    // Raw view, for callers that stride through the trace themselves
+    const PackedMCTraceRecord *begin() const { return recs; }
+
+    const PackedMCTraceRecord *end() const { return recs + numRecords; }
+};
+
+class MCTraceWriter : public GlobAlloc {
+private:
+    struct Slot {
+        PackedMCTraceRecord rec;
+        uint64_t seq;  // global arrival order, used to merge rings
+    };
+
+    // Single-producer (the simulation thread running srcId), single-consumer (writer thread) ring
+    struct Ring {
+        Slot *slots;
+        PAD();
+        volatile uint64_t head;  // next slot to fill, written by producer
+        PAD();
+        volatile uint64_t tail;  // next slot to drain, written by writer thread
+        PAD();
+    };
+
+    Ring *rings;
+    uint32_t numRings;
+    uint32_t ringMask;
+    uint32_t lastRing;  // writer thread only; rings tend to produce runs
+
+    PAD();
+    volatile uint64_t nextSeq;
+    PAD();
+
+    // Writer thread state
+    PackedMCTraceRecord *outBuf;
+    uint32_t outCur;
+    uint32_t outMax;
+    uint64_t written;
+    uint64_t maxRecords;
+    int fd;
+    g_string fname;
+
+    volatile bool terminate;
+    volatile bool done;
+
+public:
+    // ringEntries is rounded up to a power of 2. Records beyond maxRecords are dropped.
+    MCTraceWriter(const g_string &fname, uint32_t numRings, uint32_t ringEntries, uint64_t maxRecords);
+
+    inline void write(uint64_t pc, uint64_t lineAddr, bool dirty, uint32_t srcId, uint64_t cycle) {
+        uint64_t seq = __sync_fetch_and_add(&nextSeq, 1);
+        if (unlikely(seq >= maxRecords)) return;
+
+        // srcIds are core ids, so this is a private ring unless there are no cores (trace-driven sims are single-threaded)
+        Ring &r = rings[srcId % numRings];
+        uint64_t h = r.head;
+        while (unlikely(h - r.tail > ringMask)) usleep(10);  // writer thread is behind, wait for it
+
+        Slot &s = r.slots[h & ringMask];
+        s.rec.pc = pc;
+        s.rec.lineAddr = lineAddr;
+        s.rec.cycle = cycle;
+        s.rec.srcId = srcId;
+        s.rec.dirty = dirty;
+        s.seq = seq;
+        __sync_synchronize();  // publish slot before head
+        r.head = h + 1;
+    }
+
+    // Drains all rings and closes the file. Must be called by the process that created the writer,
+    // once no more records will be written (i.e., at termination).
+    void finish();
+
+private:
+    bool drain();
+
+    void flushOut();
+
+    void writerLoop();
+
+    static void WriterThreadTrampoline(void *arg);
+};
+
+#endif  // MC_TRACING_H_
@@ -0,0 +1,215 @@
+/* Trace-driven DRAM cache simulator. Replays MemoryController traces (see
+ * mc_tracing.h) through the DRAM cache schemes and placement policies, without
+ * Pin or the core/cache models. The LLC miss stream does not depend on the DRAM
+ * cache configuration, so one traced run can drive many design points: each
+ * design point gets its own MemoryController, and design points are simulated
+ * in parallel over a single memory-mapped copy of the trace.
+ *
+ * Design points are the cross product of the key=v1,v2,... sweeps given on the
+ * command line, each applied on top of the base zsim config, e.g.:
+ *   mcreplay -j 8 mc.trace zsim.cfg sys.mem.mcdram.size=64,128,256 \
+ *       sys.mem.mcdram.placementPolicy=LRU,FBR sys.mem.mcdram.sampleRate=0.1,1.0
+ *
+ * With -s N, each design point is replayed by N threads, which take interleaved
+ * blocks of the trace. This exercises the MemoryController's stripe locking
+ * (e.g., tests/mcreplay_hybrid.cfg), at the cost of some reordering.
+ *
+ * There is no weave phase, so the ext_dram and mcdram types must be Simple
+ * (fixed latency). The interesting outputs are the functional ones: hit rates,
+ * placements, evictions, and per-device traffic.
+ */
+
+#include <algorithm>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "galloc.h"
+#include "log.h"
+#include "mc.h"
+#include "mc_telemetry.h"
+#include "mc_tracing.h"
+#include "profile_stats.h"
+#include "stats.h"
+#include "zsim.h"
+
+GlobSimInfo *zinfo;
+
+struct DesignPoint {
+    std::string desc;  // overrides, in key=value form
+    MemoryController *mc;
+    AggregateStat *stats;
+};
+
+static const MCTraceReader *trace;
+static uint64_t replayRecords;
+static std::vector<DesignPoint> points;
+static uint32_t shardsPerPoint;
+static volatile uint32_t nextShard;
+
+#define REPLAY_BLOCK 256  // records; shards of a point take interleaved blocks
+
+static void replay(DesignPoint &p, uint32_t shard) {
+    MESIState state;
+    uint64_t startNs = getNs();
+    uint64_t records = 0;
+    uint64_t stride = REPLAY_BLOCK * shardsPerPoint;
+    for (uint64_t b = shard * REPLAY_BLOCK; b < replayRecords; b += stride) {
+        const PackedMCTraceRecord *end = trace->begin() + std::min(b + REPLAY_BLOCK, replayRecords);
+        for (const PackedMCTraceRecord *r = trace->begin() + b; r != end; r++) {
+            MemReq req = {r->lineAddr, r->dirty ? PUTX : GETS, 0, &state, r->cycle, nullptr, I, r->srcId, 0};
+            req.pc = r->pc;
+            p.mc->access(req);
+            records++;
+        }
+    }
+    double secs = (getNs() - startNs) / 1e9;
+    info("Finished [%s] shard %d: %ld records in %.2f s (%.2f Mrecords/s)", p.desc.c_str(), shard, records, secs,
+         records / secs / 1e6);
+}
+
+static void *replayThread(void *arg) {
+    while (true) {
+        uint32_t idx = __sync_fetch_and_add(&nextShard, 1);
+        if (idx >= points.size() * shardsPerPoint) break;
+        replay(points[idx / shardsPerPoint], idx % shardsPerPoint);
+    }
+    return nullptr;
+}
+
+static uint64_t statValue(AggregateStat *s, const char *name) {
+    for (uint32_t i = 0; i < s->size(); i++) {
+        ScalarStat *ss = dynamic_cast<ScalarStat *>(s->get(i));
+        if (ss && strcmp(ss->name(), name) == 0) return ss->get();
+    }
+    panic("No stat %s in %s", name, s->name());
+}
+
+static void usage(const char *prog) {
+    info("Replays a MemoryController trace through one or more DRAM cache configurations");
+    info("Usage: %s [-j threads] [-s threadsPerPoint] [-n records] [-m heapMB] [-o statsFile] <trace> <config> "
+         "[key=v1,v2,... ...]", prog);
+    info("  Each key=values sweep overrides a setting of <config>; all combinations are simulated");
+    info("  With -s, each design point is replayed concurrently by several threads");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    InitLog("[R] ");
+
+    uint32_t numThreads = 0;
+    uint64_t maxRecords = 0;
+    uint64_t heapMB = 0;
+    const char *statsFile = "mcreplay.out";
+    shardsPerPoint = 1;
+    int c;
+    while ((c = getopt(argc, argv, "j:s:n:m:o:")) != -1) {
+        switch (c) {
+            case 'j': numThreads = atoi(optarg); break;
+            case 's': shardsPerPoint = atoi(optarg); break;
+            case 'n': maxRecords = strtoull(optarg, nullptr, 0); break;
+            case 'm': heapMB = strtoull(optarg, nullptr, 0); break;
+            case 'o': statsFile = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (argc - optind < 2 || !shardsPerPoint) usage(argv[0]);
+    const char *traceFile = argv[optind];
+    const char *configFile = argv[optind + 1];
+
+    // Expand sweeps into design points (cross product, last sweep varies fastest)
+    std::vector<std::vector<std::string>> overrides(1);
+    for (int i = optind + 2; i < argc; i++) {
+        const char *eq = strchr(argv[i], '=');
+        if (!eq || eq == argv[i]) panic("Invalid sweep %s, expected key=v1,v2,...", argv[i]);
+        std::string key(argv[i], eq - argv[i]);
+        std::vector<std::string> values;
+        Tokenize(eq + 1, values, ",");
+
+        std::vector<std::vector<std::string>> expanded;
+        for (auto &o : overrides) {
+            for (auto &v : values) {
+                if (v.empty()) panic("Empty value in sweep %s", argv[i]);
+                expanded.push_back(o);
+                expanded.back().push_back(key + "=" + v);
+            }
+        }
+        overrides.swap(expanded);
+    }
+
+    if (!heapMB) heapMB = 1024 * overrides.size();
+    gm_init(heapMB << 20 /*MB to Bytes*/);
+    zinfo = gm_calloc<GlobSimInfo>();
+    zinfo->lineSize = 64;
+    zinfo->mcTraceWriters = new g_vector<MCTraceWriter *>();
+    zinfo->mcTelemetryWriters = new g_vector<MCTelemetryWriter *>();
+
+    MCTraceReader tr(traceFile);
+    trace = &tr;
+    replayRecords = (maxRecords && maxRecords < tr.getNumRecords()) ? maxRecords : tr.getNumRecords();
+    info("Replaying %ld records of %s over %ld design points", replayRecords, traceFile, overrides.size());
+
+    AggregateStat *rootStat = new AggregateStat();
+    rootStat->init("root", "mcreplay stats");
+    for (uint32_t i = 0; i < overrides.size(); i++) {
+        Config config(configFile);
+        // Replays never write traces; this lets the config that produced the trace be reused as is
+        config.set("sys.mem.enableTrace", "false");
+        // With sys.mem.telemetryInterval set, each design point writes <statsFile>.<point>.telemetry
+        config.set("sys.mem.telemetryFile", (std::string(statsFile) + "." + std::to_string(i) + ".telemetry").c_str());
+        std::string desc;
+        for (auto &o : overrides[i]) {
+            size_t eq = o.find('=');
+            config.set(o.substr(0, eq).c_str(), o.substr(eq + 1).c_str());
+            desc += (desc.empty() ? "" : " ") + o;
+        }
+        if (desc.empty()) desc = "base";
+
+        uint32_t frequency = config.get<uint32_t>("sys.frequency", 2000);
+        g_string name("mem-0");
+        DesignPoint p = {desc, new MemoryController(name, frequency, 0, config), new AggregateStat()};
+        p.stats->init(gm_strdup(("point-" + std::to_string(i)).c_str()), gm_strdup(desc.c_str()));
+        p.mc->initStats(p.stats);
+        rootStat->append(p.stats);
+        points.push_back(p);
+    }
+    rootStat->makeImmutable();
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (!numThreads) numThreads = (cpus > 0) ? cpus : 1;
+    if (numThreads < shardsPerPoint) numThreads = shardsPerPoint;  // so that the shards of a point run concurrently
+    if (numThreads > points.size() * shardsPerPoint) numThreads = points.size() * shardsPerPoint;
+    info("Using %d replay threads, %d per design point", numThreads, shardsPerPoint);
+
+    nextShard = 0;
+    std::vector<pthread_t> threads(numThreads);
+    for (uint32_t i = 0; i < numThreads; i++) {
+        if (pthread_create(&threads[i], nullptr, replayThread, nullptr)) panic("Could not create replay thread %d", i);
+    }
+    for (uint32_t i = 0; i < numThreads; i++) pthread_join(threads[i], nullptr);
+    for (MCTelemetryWriter *t : *(zinfo->mcTelemetryWriters)) t->finish();
+
+    TextBackend backend(statsFile, rootStat);
+    backend.dump(false);
+    info("Wrote stats to %s", statsFile);
+
+    // Summary, one line per design point
+    printf("%-6s %12s %8s %8s %12s %12s  %s\n", "point", "requests", "ldHit%", "stHit%", "placements", "dirtyEvict",
+           "config");
+    for (uint32_t i = 0; i < points.size(); i++) {
+        AggregateStat *s = dynamic_cast<AggregateStat *>(points[i].stats->get(0));
+        uint64_t ldHit = statValue(s, "loadHit");
+        uint64_t ldMiss = statValue(s, "loadMiss");
+        uint64_t stHit = statValue(s, "storeHit");
+        uint64_t stMiss = statValue(s, "storeMiss");
+        printf("%-6d %12ld %8.2f %8.2f %12ld %12ld  %s\n", i, points[i].mc->getNumRequests(),
+               100.0 * ldHit / std::max(ldHit + ldMiss, 1ul), 100.0 * stHit / std::max(stHit + stMiss, 1ul),
+               statValue(s, "placement"), statValue(s, "dirtyEvict"), points[i].desc.c_str());
+    }
+    return 0;
+}
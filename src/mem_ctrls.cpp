@@ -50,6 +50,12 @@ SimpleMemory::SimpleMemory(uint32_t _latency, g_string &_name, Config &config)
 }
 
 uint64_t SimpleMemory::access(MemReq &req) {
+    return access(req, 0, 4);  // one line
+}
+
+// data_size is the number of bursts (16 bytes each), as in DDRMemory. Latency is fixed, so the access type
+// and size only matter for the traffic stats.
+uint64_t SimpleMemory::access(MemReq &req, int type, uint32_t data_size) {
     if (_collect_trace) {
         futex_lock(&_lock);
         _address_trace[_cur_trace_len] = req.lineAddr;
@@ -88,6 +94,9 @@ uint64_t SimpleMemory::access(MemReq &req) {
         default: panic("!?");
     }
 
+    if (req.type == PUTS || req.type == PUTX) bytesWrites.inc(16 * data_size);
+    else bytesReads.inc(16 * data_size);
+
     uint64_t respCycle = req.cycle + latency;
     assert(respCycle > req.cycle);
 /*
@@ -51,12 +51,27 @@ private:
 
     lock_t _lock;
     Chunk *temp;
+
+    Counter bytesReads;
+    Counter bytesWrites;
 public:
     uint64_t access(MemReq &req);
 
+    uint64_t access(MemReq &req, int type, uint32_t data_size);
+
     const char *getName() { return name.c_str(); }
 
     SimpleMemory(uint32_t _latency, g_string &_name, Config &config);
+
+    void initStats(AggregateStat *parentStat) {
+        AggregateStat *memStats = new AggregateStat();
+        memStats->init(name.c_str(), "Memory controller stats");
+        bytesReads.init("tot_rd", "Total Bytes Read");
+        memStats->append(&bytesReads);
+        bytesWrites.init("tot_wr", "Total Bytes Write");
+        memStats->append(&bytesWrites);
+        parentStat->append(memStats);
+    }
 };
 
 
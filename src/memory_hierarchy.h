@@ -32,6 +32,7 @@
 #include "pin.H"
 #include "pin_cmd.h"
 #include "g_std/g_vector.h"
+#include "constants.h"
 #include "galloc.h"
 #include "locks.h"
 
@@ -110,7 +111,12 @@ struct MemReq {
     uint32_t flags;
 
     Address pc; //Kasraa
+    // Line value for the data-aware arrays; null when no array keeps values (zinfo->dataAwareCaches)
+#if VALUE_TRACKING
     void* value;
+#else
+    static constexpr void* value = nullptr;
+#endif
     UINT32 size;
     unsigned int line_offset;
     Address vLineAddr;
@@ -120,6 +126,13 @@ struct MemReq {
     inline bool is(Flag f) const { return flags & f; }
 };
 
+// Initializes MemReq::value in a brace-initialized request; empty when value tracking is compiled out
+#if VALUE_TRACKING
+#define MEMREQ_VALUE(v) v,
+#else
+#define MEMREQ_VALUE(v)
+#endif
+
 /* Invalidation/downgrade request */
 struct InvReq {
     Address lineAddr;
@@ -75,6 +75,8 @@ OOOCore::OOOCore(FilterCache *_l1i, FilterCache *_l1d, g_string &_name) : Core(_
     instrs = uops = bbls = approxInstrs = mispredBranches = 0;
 
     for (uint32_t i = 0; i < FWD_ENTRIES; i++) fwdArray[i].set((Address) (-1L), 0);
+
+    lineValue = gm_memalign<char>(CACHE_LINE_BYTES, zinfo->lineSize);
 }
 
 void OOOCore::initStats(AggregateStat *parentStat) {
@@ -186,6 +188,7 @@ inline void OOOCore::load(Address addr, Address pc /*Kasraa*/, void *value,
     loadAddrs[currIdx] = addr;
     loadPCs[currIdx] = pc;
     loadSizes[currIdx] = size;
+    loadValues[currIdx] = value;
 }
 
 void OOOCore::store(Address addr, Address pc /*Kasraa*/, void *value,
@@ -197,6 +200,7 @@ void OOOCore::store(Address addr, Address pc /*Kasraa*/, void *value,
     storeAddrs[currIdx] = addr;
     storePCs[currIdx] = pc;
     storeSizes[currIdx] = size;
+    storeValues[currIdx] = value;
 }
 
 // Predicated loads and stores call this function, gets recorded as a 0-cycle op.
@@ -210,6 +214,7 @@ void OOOCore::predFalseMemOp() {    //Kasraa: I heavily modified this function
     loadAddrs[currIdx] = -1L;
     loadPCs[currIdx] = -1L;
     loadSizes[currIdx] = -1L;
+    loadValues[currIdx] = nullptr;
 }
 
 void OOOCore::branch(Address pc, bool taken, Address takenNpc, Address notTakenNpc) {
@@ -219,6 +224,15 @@ void OOOCore::branch(Address pc, bool taken, Address takenNpc, Address notTakenN
     branchNotTakenNpc = notTakenNpc;
 }
 
+// Copies the line of an instruction fetch into lineValue, and returns it as the access value. Without data-aware
+// cache arrays, nothing uses the value, so there is no copy and the value is null.
+inline void *OOOCore::captureLine(Address addr) {
+    if (!zinfo->dataAwareCaches) return nullptr;
+    ADDRINT lineBegin = ((addr >> lineBits) | procMask) << lineBits;
+    PIN_SafeCopy(lineValue, (ADDRINT *) lineBegin, 1U << lineBits);
+    return lineValue;
+}
+
 inline void OOOCore::bbl(Address bblAddr, BblInfo *bblInfo) {
     if (!prevBbl) {
         // This is the 1st BBL since scheduled, nothing to simulate
@@ -342,13 +356,8 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo *bblInfo) {
 //                    morteza << "load 0x" << setw(15) << std::hex << std::left << addr << " with index " << loadsCurrIdx << " ";
 //                    EmitMem(loadValues[loadsCurrIdx], size, addr & ((1U << lineBits) - 1));
 
-                    char *value = gm_malloc<char>(1U << lineBits);
-                    ADDRINT lineBegin = ((addr >> lineBits) | procMask) << lineBits;
-                    PIN_SafeCopy(value, (ADDRINT *) lineBegin, 1U << lineBits);
-
-                    reqSatisfiedCycle = l1d->load(addr, dispatchCycle, pc /*Kasraa*/, value, size) + L1D_LAT;
-
-                    gm_free(value);
+                    reqSatisfiedCycle = l1d->load(addr, dispatchCycle, pc /*Kasraa*/, loadValues[loadsCurrIdx],
+                                                  size) + L1D_LAT;
 
                     cRec.record(curCycle, dispatchCycle, reqSatisfiedCycle);
                 }
@@ -396,14 +405,10 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo *bblInfo) {
 //                morteza << "stor 0x" << setw(15) << std::hex << std::left << addr << " ";
 //                EmitMem(value, size, addr & ((1U << lineBits) - 1));
 
-                char *value = gm_malloc<char>(1U << lineBits);
-                ADDRINT lineBegin = ((addr >> lineBits) | procMask) << lineBits;
-                PIN_SafeCopy(value, (ADDRINT *) lineBegin, 1U << lineBits);
-
+                // The snapshot already holds the stored bytes (patched right after the store executed)
+                void *value = storeValues[storesCurrIdx];
                 uint64_t reqSatisfiedCycle = l1d->store(addr, dispatchCycle, pc /*Kasraa*/, value, size) + L1D_LAT;
 
-                gm_free(value);
-
                 cRec.record(curCycle, dispatchCycle, reqSatisfiedCycle);
 
                 // Fill the forwarding table
@@ -505,18 +510,11 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo *bblInfo) {
         uint64_t reqCycle = fetchCycle;
 
         for (uint32_t i = 0; i < 5 * 64 / lineSize; i++) {
-
-            char *value = new char[lineSize];
-            ADDRINT lineBegin = (((wrongPathAddr + lineSize * i) >> lineBits) | procMask) << lineBits;
-            PIN_SafeCopy(value, (ADDRINT *) lineBegin, lineSize);
-
             uint64_t fetchLat = l1i->load(wrongPathAddr + lineSize * i,
                                           curCycle,
                                           wrongPathAddr +
                                           lineSize * i, /*Kasraa: This is instruction cache and the PC is not required*/
-                                          value, lineSize) - curCycle;
-
-            delete[] value;
+                                          captureLine(wrongPathAddr + lineSize * i), lineSize) - curCycle;
 
             cRec.record(curCycle, curCycle, curCycle + fetchLat);
             uint64_t respCycle = reqCycle + fetchLat;
@@ -539,16 +537,10 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo *bblInfo) {
         // Do not model fetch throughput limit here, decoder-generated stalls already include it
         // We always call fetches with curCycle to avoid upsetting the weave
         // models (but we could move to a fetch-centric recorder to avoid this)
-
-        char *value = new char[lineSize];
-        ADDRINT lineBegin = ((fetchAddr >> lineBits) | procMask) << lineBits;
-        PIN_SafeCopy(value, (ADDRINT *) lineBegin, lineSize);
-
         uint64_t fetchLat = l1i->load(fetchAddr,
                                       curCycle,
                                       fetchAddr /*Kasraa: This is instruction cache and the PC is not required*/,
-                                      value, lineSize) - curCycle;
-        delete[] value;
+                                      captureLine(fetchAddr), lineSize) - curCycle;
 
         cRec.record(curCycle, curCycle, curCycle + fetchLat);
         fetchCycle += fetchLat;
@@ -382,10 +382,12 @@ private:
     Address loadAddrs[256];
     Address loadPCs[256];   //Kasraa
     UINT32 loadSizes[256];
+    void *loadValues[256];  // line snapshots from the instrumentation (null without data-aware caches)
 
     Address storeAddrs[256];
     Address storePCs[256];  //Kasraa
     UINT32 storeSizes[256];
+    void *storeValues[256];  // line snapshots from before the store; the stored bytes are added at simulation
 
     uint32_t loads;
     uint32_t stores;
@@ -451,6 +453,10 @@ private:
 
     OOOCoreRecorder cRec;
 
+    // Line values of instruction fetches for the data-aware cache arrays. Fetches are simulated one at a time
+    // and the caches copy what they keep, so a single buffer serves all of them.
+    char *lineValue;
+
 public:
     OOOCore(FilterCache *_l1i, FilterCache *_l1d, g_string &_name);
 
@@ -500,6 +506,8 @@ private:
 
     inline void bbl(Address bblAddr, BblInfo *bblInfo);
 
+    inline void *captureLine(Address addr);
+
     static void LoadFunc(THREADID tid, ADDRINT addr, ADDRINT pc /*Kasraa*/, void* value, UINT32 size);
 
     static void StoreFunc(THREADID tid, ADDRINT addr, ADDRINT pc /*Kasraa*/, void* value, UINT32 size);
@@ -1,54 +1,69 @@
 #include "os_placement.h"
-#include "cache.h"
-#include <queue>
-#include <vector>
-#include <functional>
-
-void
-OSPlacementPolicy::handleCacheAccess(Address tag, ReqType type) {
-    //map<Address, TLBEntry> &tlb = *_mc->getTLB();
-    //assert(tlb.find(tag) != tlb.end());
-    //tlb[tag].count ++;
-}
+#include <algorithm>
 
 uint64_t
 OSPlacementPolicy::remapPages() {
-    /*
-    map<Address, TLBEntry> &tlb = *_mc->getTLB();
-    // sort the pages based on frequency.
-    // if they have the same frequency, prioritize the page already cached.
-    auto cmp = [](TLBEntry * left, TLBEntry * right) { return (left->count < right->count); };
-    priority_queue<TLBEntry *, vector<TLBEntry *>, decltype(cmp)> queue(cmp);
-    //priority_queue<TLBEntry *> queue(cmp);
-    //printf("size = %ld\n", tlb.size());
-    for(map<Address, TLBEntry>::iterator it = tlb.begin(); it != tlb.end(); ++it) {
-       // move the page out of dram cache.
-       it->second.way = _mc->getNumWays();
-       queue.push(&it->second);
+    assert(_mc->getNumSets() == 1);
+    uint32_t num_ways = _mc->getNumWays();
+    PageTable *tlb = _mc->getTLB(0);
+    Set &set = _mc->getSets()[0];
+
+    // Top num_ways touched pages by count, with a bounded heap. Counts of pages touched this
+    // epoch are up to date (age 0).
+    _hot.clear();
+    for (Address tag : _touched) {
+        TLBEntry *e = tlb->lookup(tag);
+        assert(e && e->epoch == _epoch && e->way == num_ways);
+        HotPage p = {e->count, e};
+        if (_hot.size() < num_ways) {
+            _hot.push_back(p);
+            std::push_heap(_hot.begin(), _hot.end(), hotter);
+        } else if (hotter(p, _hot.front())) {
+            std::pop_heap(_hot.begin(), _hot.end(), hotter);
+            _hot.back() = p;
+            std::push_heap(_hot.begin(), _hot.end(), hotter);
+        }
     }
+    _touched.clear();
+    std::sort_heap(_hot.begin(), _hot.end(), hotter);  // hottest first
 
-    uint64_t cur_way = 0;
-    assert(_mc->getNumSets() == 1);
-    uint64_t num_replace = 0;
-    for (uint64_t i = 0; i < _mc->getNumWays(); i++) {
-       if (i == tlb.size())
-          break;
-       TLBEntry * top = queue.top();
-       if (top->way == _mc->getNumWays())
-           num_replace ++;
-       top->way = cur_way;
-       queue.pop();
+    // Move the hot pages in, hottest first. The clock hand takes empty ways, and ways whose pages
+    // are strictly colder than the page moving in (ties stay, so equally hot pages do not
+    // ping-pong). Pages moved in are at least as hot as the ones after them, so they stay too.
+    _moves.clear();
+    for (HotPage &p : _hot) {
+        uint32_t way = num_ways;
+        TLBEntry *evicted_entry = nullptr;
+        for (uint32_t i = 0; i < VICTIM_SCAN && i < num_ways; i++) {
+            uint32_t w = _clock_way;
+            _clock_way = (_clock_way + 1 == num_ways) ? 0 : _clock_way + 1;
+            if (!set.isValid(w)) {
+                way = w;
+                break;
+            }
+            TLBEntry *v = tlb->lookup(set.getTag(w));
+            assert(v && v->way == w);
+            if (decayed(v->count, _epoch - v->epoch) < p.count) {
+                way = w;
+                evicted_entry = v;
+                break;
+            }
+        }
+        if (way == num_ways) break;  // no colder page nearby
 
-       Set * cache = _mc->getSets();
-       cache[0].ways[cur_way].valid = true;
-       cache[0].ways[cur_way].tag = top->tag;
-       cache[0].ways[cur_way].dirty = false;
-       cur_way ++;
+        PageMove move = {p.entry->tag, way, set.isValid(way), set.isValid(way) && set.isDirty(way), 0};
+        if (move.evicted) {
+            move.evicted_tag = set.getTag(way);
+            evicted_entry->way = num_ways;
+        }
+        set.fill(way, p.entry->tag, false);
+        p.entry->way = way;
+        _moves.push_back(move);
     }
-    // Clear all the counters in TLB
-    for(map<Address, TLBEntry>::iterator it = tlb.begin(); it != tlb.end(); ++it)
-       it->second.count /= 2;
-    return num_replace;
-    */
-    return 0;
+    if (++_epoch == 0) _epoch = 1;  // 0 is the epoch of pages never counted
+    return _moves.size();
+}
+
+void
+OSPlacementPolicy::clearStats() {
 }
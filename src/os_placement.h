@@ -2,21 +2,72 @@
 
 #include "memory_hierarchy.h"
 #include "mc.h"
+#include "g_std/g_vector.h"
 
 class DramCache;
 
+// HMA: the OS periodically (every sys.mem.os_quantum requests) migrates the hottest pages
+// into the DRAM cache, based on per-page access counts kept in the MC page table.
+// Counts halve every epoch, lazily: each TLBEntry records the epoch of its last update.
+// The pages touched in an epoch are its only candidates, and a clock hand over the ways
+// finds colder victims, so an epoch costs O(pages touched + pages moved), whatever the
+// footprint and the cache size.
 class OSPlacementPolicy {
 public:
-    OSPlacementPolicy(MemoryController *mc) : _mc(mc) {};
+    // One page migrated into the DRAM cache by remapPages()
+    struct PageMove {
+        Address tag;  // page moved in
+        uint32_t way;
+        bool evicted;  // a page was moved out of way to make room
+        bool evicted_dirty;
+        Address evicted_tag;
+    };
 
-    void handleCacheAccess(Address tag, ReqType type);
+    OSPlacementPolicy(MemoryController *mc) : _mc(mc), _epoch(1), _clock_way(0) {};
 
+    // Caller must hold the (only) stripe lock
+    inline void handleCacheAccess(TLBEntry *entry, ReqType type) {
+        uint16_t age = _epoch - entry->epoch;
+        if (age) {
+            entry->count = decayed(entry->count, age);
+            entry->epoch = _epoch;
+            if (entry->way == _mc->getNumWays()) _touched.push_back(entry->tag);  // first touch this epoch
+        }
+        if (entry->count < UINT16_MAX) entry->count++;
+    }
+
+    // Places the hottest uncached pages touched this epoch in the cache, in place of colder
+    // pages, and starts a new epoch. Returns the number of pages moved in; getMoves() has the
+    // details. Caller must hold all stripe locks.
     uint64_t remapPages();
 
+    const g_vector<PageMove> &getMoves() const { return _moves; }
+
     void clearStats();
-    //void printInfo();
 
 private:
+    struct HotPage {
+        uint32_t count;
+        TLBEntry *entry;
+    };
+
+    // Ways looked at for a colder page per page moved in; once a candidate finds none, the
+    // colder ones would not either, and the epoch ends
+    static const uint32_t VICTIM_SCAN = 64;
+
+    // A count not updated for age epochs. Counts saturate at 16 bits, so they reach 0 after 16
+    // epochs; an epoch stamp only wraps (and may revive a stale count) after 64K idle epochs.
+    static inline uint16_t decayed(uint16_t count, uint16_t age) {
+        return (age < 16) ? (count >> age) : 0;
+    }
+
+    static inline bool hotter(const HotPage &a, const HotPage &b) { return a.count > b.count; }
 
     MemoryController *_mc;
+    uint16_t _epoch;
+    uint32_t _clock_way;  // next victim candidate, persists across epochs
+    // Reused across epochs
+    g_vector<Address> _touched;  // uncached pages first touched this epoch (tags: entries move on inserts)
+    g_vector<HotPage> _hot;  // bounded heap, coldest page at the top
+    g_vector<PageMove> _moves;
 };
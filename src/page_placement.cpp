@@ -29,7 +29,9 @@ PagePlacementPolicy::initialize(Config &config) {
             _chunks[i].entries[j].valid = false;
     }
     _histogram = NULL;
-    srand48_r(rand(), &_buffer);
+    _stripes = gm_memalign<StripeState>(CACHE_LINE_BYTES, _mc->getNumStripes());
+    for (uint32_t i = 0; i < _mc->getNumStripes(); i++)
+        srand48_r(rand(), &_stripes[i].buffer);
     clearStats();
 
     g_string scheme = config.get<const char *>("sys.mem.mcdram.placementPolicy");
@@ -54,23 +56,25 @@ PagePlacementPolicy::handleCacheMiss(Address tag, ReqType type, uint64_t set_num
     _chunks[chunk_num].num_misses++;
 
     if (_placement_policy == LRU) {
-        if (set->hasEmptyWay()) {
-            updateLRU(set_num, set->getEmptyWay());
-            return set->getEmptyWay();
+        uint32_t empty_way = set->getEmptyWay();
+        if (empty_way < _mc->getNumWays()) {
+            updateLRU(set_num, empty_way);
+            return empty_way;
         }
         if (!_enable_replace)
             return _mc->getNumWays();
         double f;
         int64_t way;
-        drand48_r(&_buffer, &f);
-        lrand48_r(&_buffer, &way);
+        drand48_data *buffer = &_stripes[_mc->getStripe(set_num)].buffer;
+        drand48_r(buffer, &f);
+        lrand48_r(buffer, &way);
         if (f < _sample_rate) {
             //if (_scheme == UnisonCache) {
             for (uint32_t i = 0; i < _mc->getNumWays(); i++)
                 if (_lru_bits[set_num][i] == _mc->getNumWays() - 1) {
-                    Address victim_tag = set->ways[i].tag;
+                    Address victim_tag = set->getTag(i);
                     if (_scheme == HybridCache) {
-                        if (_mc->getTagBuffer()->canInsert(tag, victim_tag)) {
+                        if (_mc->tryRemapInTagBuffer(set_num, tag, victim_tag)) {
                             updateLRU(set_num, i);
                             return i;
                         } else
@@ -88,18 +92,18 @@ PagePlacementPolicy::handleCacheMiss(Address tag, ReqType type, uint64_t set_num
     assert(_placement_policy == FBR);
     assert(_enable_replace);
 
-#if 1
+#if CHECK_LEVEL >= CHECK_EXHAUSTIVE
     ChunkInfo *chunk = &_chunks[chunk_num];
     for (uint32_t way = 0; way < _mc->getNumWays(); way++)
-        if (set->ways[way].valid) {
-            if (set->ways[way].tag != _chunks[chunk_num].entries[way].tag) {
+        if (set->isValid(way)) {
+            if (set->getTag(way) != _chunks[chunk_num].entries[way].tag) {
                 for (uint32_t i = 0; i < _num_entries_per_chunk; i++)
                     printf("ID=%d, tag=%ld, valid=%d, count=%d\n",
                            i, chunk->entries[i].tag, chunk->entries[i].valid, chunk->entries[i].count);
                 for (uint32_t i = 0; i < _mc->getNumWays(); i++)
-                    printf("ID=%d, tag=%ld\n", i, set->ways[i].tag);
+                    printf("ID=%d, tag=%ld\n", i, set->getTag(i));
             }
-            assert(set->ways[way].tag == _chunks[chunk_num].entries[way].tag);
+            assert(set->getTag(way) == _chunks[chunk_num].entries[way].tag);
         }
 #endif
 
@@ -115,12 +119,13 @@ PagePlacementPolicy::handleCacheMiss(Address tag, ReqType type, uint64_t set_num
         sample_rate = 1;
 
     // the set uses FBR replacement policy
-    bool updateFBR = set->hasEmptyWay() || sampleOrNot(sample_rate, miss_rate_tune);
+    uint32_t empty_way = set->getEmptyWay();
+    StripeState &stripe = _stripes[_mc->getStripe(set_num)];
+    bool updateFBR = empty_way < _mc->getNumWays() || sampleOrNot(set_num, sample_rate, miss_rate_tune);
     if (updateFBR) {
-        uint32_t empty_way = set->getEmptyWay();
         counter_access = true;
-        _num_counter_read++;
-        _num_counter_write++;
+        stripe.num_counter_read++;
+        stripe.num_counter_write++;
         uint32_t idx = getChunkEntry(tag, &_chunks[chunk_num]);
         if (idx == _num_entries_per_chunk)
             return _mc->getNumWays();
@@ -135,13 +140,14 @@ PagePlacementPolicy::handleCacheMiss(Address tag, ReqType type, uint64_t set_num
         // empty slots left in dram cache
         if (empty_way < _mc->getNumWays()) {
             assert(idx == empty_way);
-            _num_empty_replace++;
+            stripe.num_empty_replace++;
             return empty_way;
         } else // figure if we can replace an entry.
         {
             assert(idx >= _mc->getNumWays());
             uint32_t victim_way = pickVictimWay(&_chunks[chunk_num]);
             assert(victim_way < _mc->getNumWays());
+            assert(_chunks[chunk_num].entries[victim_way].tag == set->getTag(victim_way));
 /*			if (compareCounter(&_chunks[chunk_num].entries[idx], &_chunks[chunk_num].entries[victim_way]) && !_mc->getTagBuffer()->canInsert(tag, _chunks[chunk_num].entries[victim_way].tag)) 
 			{
 				printf("!!!!!!Occupancy = %f\n", _mc->getTagBuffer()->getOccupancy());
@@ -151,7 +157,7 @@ PagePlacementPolicy::handleCacheMiss(Address tag, ReqType type, uint64_t set_num
 			}
 */
             if (compareCounter(&_chunks[chunk_num].entries[idx], &_chunks[chunk_num].entries[victim_way])
-                && _mc->getTagBuffer()->canInsert(tag, _chunks[chunk_num].entries[victim_way].tag)) {
+                && _mc->tryRemapInTagBuffer(set_num, tag, _chunks[chunk_num].entries[victim_way].tag)) {
                 //assert(idx < _num_stable_entries);
                 // swap current way with victim way.
                 ChunkEntry tmp = _chunks[chunk_num].entries[idx];
@@ -170,27 +176,27 @@ PagePlacementPolicy::handleCacheMiss(Address tag, ReqType type, uint64_t set_num
 void
 PagePlacementPolicy::handleCacheHit(Address tag, ReqType type, uint64_t set_num, Set *set, bool &counter_access,
                                     uint32_t hit_way) {
-    assert(tag == set->ways[hit_way].tag);
+    assert(tag == set->getTag(hit_way));
     if (_placement_policy == LRU) {
         //if (_scheme == UnisonCache)
         updateLRU(set_num, hit_way);
         return;
     }
     uint64_t chunk_num = set_num;
+#if CHECK_LEVEL >= CHECK_EXHAUSTIVE
     ChunkInfo *chunk = &_chunks[chunk_num];
-#if 1
     // for DEBUG
     // the first few entries in chunk->entries must be in dram cache
     for (uint32_t way = 0; way < _mc->getNumWays(); way++)
-        if (set->ways[way].valid) {
-            if (set->ways[way].tag != _chunks[chunk_num].entries[way].tag) {
+        if (set->isValid(way)) {
+            if (set->getTag(way) != _chunks[chunk_num].entries[way].tag) {
                 for (uint32_t i = 0; i < _num_entries_per_chunk; i++)
                     printf("ID=%d, tag=%ld, valid=%d, count=%d\n",
                            i, chunk->entries[i].tag, chunk->entries[i].valid, chunk->entries[i].count);
                 for (uint32_t i = 0; i < _mc->getNumWays(); i++)
-                    printf("ID=%dm tag=%ld\n", i, set->ways[i].tag);
+                    printf("ID=%dm tag=%ld\n", i, set->getTag(i));
             }
-            assert(set->ways[way].tag == _chunks[chunk_num].entries[way].tag);
+            assert(set->getTag(way) == _chunks[chunk_num].entries[way].tag);
         }
     // chunk->entries are properly ordered.
     /*uint32_t min_count = 10000;
@@ -206,6 +212,9 @@ PagePlacementPolicy::handleCacheHit(Address tag, ReqType type, uint64_t set_num,
             }
             assert(chunk->entries[way].count <= min_count);
         }*/
+#elif CHECK_LEVEL >= CHECK_CHEAP
+    // only the hit way is known to be in the dram cache
+    assert(_chunks[chunk_num].entries[hit_way].valid && _chunks[chunk_num].entries[hit_way].tag == tag);
 #endif
 
     double sample_rate = _sample_rate;
@@ -214,10 +223,11 @@ PagePlacementPolicy::handleCacheHit(Address tag, ReqType type, uint64_t set_num,
         miss_rate_tune = false;
     if (_mc->getNumRequests() < _mc->getNumSets() * _mc->getNumWays() * 64 * 8)
         sample_rate = 1;
-    if (sampleOrNot(sample_rate, miss_rate_tune)) {
+    if (sampleOrNot(set_num, sample_rate, miss_rate_tune)) {
+        StripeState &stripe = _stripes[_mc->getStripe(set_num)];
         counter_access = true;
-        _num_counter_read++;
-        _num_counter_write++;
+        stripe.num_counter_read++;
+        stripe.num_counter_write++;
         uint32_t idx = getChunkEntry(tag, &_chunks[chunk_num]);
         ChunkEntry *chunk_entry = &_chunks[chunk_num].entries[idx];
         assert(idx < _mc->getNumWays());
@@ -240,8 +250,9 @@ PagePlacementPolicy::getChunkEntry(Address tag, ChunkInfo *chunk_info, bool allo
     if (idx == _num_entries_per_chunk && allocate) {
         int64_t rand;
         double f;
-        lrand48_r(&_buffer, &rand);
-        drand48_r(&_buffer, &f);
+        drand48_data *buffer = &_stripes[_mc->getStripe(chunk_info - _chunks)].buffer;
+        lrand48_r(buffer, &rand);
+        drand48_r(buffer, &f);
         // randomly pick a victim entry
         idx = _mc->getNumWays() + rand % (_num_entries_per_chunk - _mc->getNumWays());
         assert(idx >= _mc->getNumWays());
@@ -259,10 +270,10 @@ PagePlacementPolicy::getChunkEntry(Address tag, ChunkInfo *chunk_info, bool allo
 }
 
 bool
-PagePlacementPolicy::sampleOrNot(double sample_rate, bool miss_rate_tune) {
-    double miss_rate = _mc->getRecentMissRate();
+PagePlacementPolicy::sampleOrNot(uint64_t set_num, double sample_rate, bool miss_rate_tune) {
+    double miss_rate = _mc->getRecentMissRate(set_num);
     double f;
-    drand48_r(&_buffer, &f);
+    drand48_r(&_stripes[_mc->getStripe(set_num)].buffer, &f);
     if (miss_rate_tune)
         return f < sample_rate * miss_rate;
     else
@@ -339,10 +350,19 @@ PagePlacementPolicy::handleCounterOverflow(ChunkInfo *chunk_info, ChunkEntry *ov
 
 void
 PagePlacementPolicy::clearStats() {
-    _num_counter_read = 0;
-    _num_counter_write = 0;
+    for (uint32_t i = 0; i < _mc->getNumStripes(); i++) {
+        _stripes[i].num_counter_read = 0;
+        _stripes[i].num_counter_write = 0;
+        _stripes[i].num_empty_replace = 0;
+    }
+}
 
-    _num_empty_replace = 0;
+uint64_t
+PagePlacementPolicy::getTraffic() {
+    uint64_t traffic = 0;
+    for (uint32_t i = 0; i < _mc->getNumStripes(); i++)
+        traffic += _stripes[i].num_counter_read + _stripes[i].num_counter_write;
+    return traffic;
 }
 
 void
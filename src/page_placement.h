@@ -3,8 +3,6 @@
 #include "config.h"
 #include "mc.h"
 
-class Way;
-
 class Set;
 
 class DramCache;
@@ -24,7 +22,7 @@ public:
 
     void handleCacheHit(Address tag, ReqType type, uint64_t set_num, Set *set, bool &counter_access, uint32_t hit_way);
 
-    uint64_t getTraffic() { return _num_counter_read + _num_counter_write; };
+    uint64_t getTraffic();
 
     void flushChunk(uint32_t set);
 
@@ -48,7 +46,7 @@ private:
 
     uint32_t getChunkEntry(Address tag, ChunkInfo *chunk_info, bool allocate = true);
 
-    bool sampleOrNot(double sample_rate, bool miss_rate_tune = true);
+    bool sampleOrNot(uint64_t set_num, double sample_rate, bool miss_rate_tune = true);
 
     bool compareCounter(ChunkEntry *entry1, ChunkEntry *entry2);
 
@@ -65,7 +63,14 @@ private:
     double getCurrSampleRate();
 
     RepScheme _placement_policy;
-    drand48_data _buffer;
+    // Per set stripe (see SetStripe); only used by the holder of the stripe lock
+    struct StripeState {
+        drand48_data buffer;
+        uint64_t num_counter_read;
+        uint64_t num_counter_write;
+        uint64_t num_empty_replace;
+    } ATTR_LINE_ALIGNED;
+    StripeState *_stripes;
     Scheme _scheme;
     uint32_t **_lru_bits; // on per set
 
@@ -84,7 +89,4 @@ private:
 
     // Stats
     uint64_t *_histogram;
-    uint64_t _num_counter_read;
-    uint64_t _num_counter_write;
-    uint64_t _num_empty_replace;
 };
@@ -259,17 +259,21 @@ uint64_t StreamPrefetcher::access(MemReq &req) {
                     DBG("issuing prefetch");
                     MESIState state = I;
 
-                    unsigned int lineSize = (1U << lineBits);
-                    ADDRINT lineBegin = ((req.vLineAddr + prefetchPos - pos) >> lineBits) << lineBits;
-                    char *value = new char[lineSize];
-                    PIN_SafeCopy(value, ((ADDRINT *) lineBegin), lineSize);
+#if VALUE_TRACKING
+                    // Data-aware arrays keep the value of the prefetched line; it is only read during the access
+                    char lineValue[MAX_LINE_BYTES];
+                    void *value = nullptr;
+                    if (zinfo->dataAwareCaches) {
+                        ADDRINT lineBegin = (req.vLineAddr + prefetchPos - pos) << lineBits;  // vLineAddr is a line address
+                        PIN_SafeCopy(lineValue, ((ADDRINT *) lineBegin), 1U << lineBits);
+                        value = lineValue;
+                    }
+#endif
 
                     MemReq pfReq = {req.lineAddr + prefetchPos - pos, GETS, req.childId, &state, reqCycle,
                                     req.childLock, state, req.srcId, MemReq::PREFETCH,
                                     req.pc /*Kasraa: It is a bit non-trivial, but the best I can do for now. Prefetch requests carry PC of trigger access*/,
-                                    value, 0, 0, req.vLineAddr}; 
-
-                    delete[] value;
+                                    MEMREQ_VALUE(value) 0, 0, req.vLineAddr};
                     uint64_t pfRespCycle = parent->access(pfReq);
                     assert(state == I);  // prefetch access should not give us any permissions
 
@@ -28,6 +28,15 @@
 
 #include "g_std/g_multimap.h"
 
+/* Events beyond the near window (B blocks of 64 cycles) are kept in a far
+ * structure and moved into the window as it advances. PQ_FAR_MAP keeps them
+ * in a multimap (one tree node allocated per event); PQ_FAR_RADIX keeps them
+ * in a radix heap of intrusive lists, which allocates nothing. The radix heap
+ * uses T::next and stores the cycle in T::privCycle, so T must make
+ * PrioQueue a friend.
+ */
+enum PQFarMode {PQ_FAR_MAP, PQ_FAR_RADIX};
+
 template<typename T, uint32_t B>
 class PrioQueue {
     struct PQBlock {
@@ -60,20 +69,119 @@ class PrioQueue {
         }
     };
 
+    static_assert(B % 64 == 0, "PrioQueue needs a multiple of 64 blocks");
+
     PQBlock blocks[B];
+    uint64_t blockOcc[B / 64]; // bit i is 1 if blocks[i] is populated, to skip empty blocks quickly
 
     typedef g_multimap<uint64_t, T *> FEMap; //far element map
     typedef typename FEMap::iterator FEMapIterator;
 
     FEMap feMap;
 
+    /* Radix heap: bucket 0 holds elements at radixLast, bucket k > 0 those whose highest bit differing from
+     * radixLast is bit k-1, so all elements in a bucket precede those in higher buckets. Far elements are
+     * always >= radixLast (they lie beyond every previous window), and each refill moves the elements of the
+     * lowest bucket either into the window or into strictly lower buckets.
+     */
+    T *radixBuckets[64];
+    uint64_t radixMin[64];
+    uint64_t radixOcc; // bit k is 1 if radixBuckets[k] is populated
+    uint64_t radixLast;
+
+    PQFarMode farMode;
     uint64_t curBlock;
     uint64_t elems;
+    uint64_t farElems;
+
+    inline void nearEnqueue(T *obj, uint64_t cycle) {
+        uint64_t absBlock = cycle / 64;
+        assert(absBlock >= curBlock);
+        assert(absBlock < curBlock + B);
+        uint32_t i = absBlock % B;
+        blocks[i].enqueue(obj, cycle % 64);
+        blockOcc[i / 64] |= 1ul << (i % 64);
+    }
+
+    //Blocks from curBlock to the first populated block, B if none
+    inline uint32_t nearDistance() const {
+        uint32_t start = curBlock % B;
+        if (blocks[start].occ) return 0; //common case
+        uint32_t w = start / 64;
+        uint64_t word = blockOcc[w] & (~0ul << (start % 64));
+        for (uint32_t i = 0; i <= B / 64; i++) {
+            if (word) return (((w + i) % (B / 64)) * 64 + __builtin_ctzl(word) + B - start) % B;
+            if (i == B / 64) break;
+            word = blockOcc[(w + i + 1) % (B / 64)];
+            if (i + 1 == B / 64) word &= ~(~0ul << (start % 64)); //wrapped around to the start word
+        }
+        return B;
+    }
+
+    inline void radixEnqueue(T *obj, uint64_t cycle) {
+        assert(cycle >= radixLast);
+        uint32_t b = (cycle == radixLast) ? 0 : 64 - __builtin_clzl(cycle ^ radixLast);
+        assert(b < 64);
+        obj->privCycle = cycle;
+        obj->next = radixBuckets[b];
+        radixBuckets[b] = obj;
+        if (!(radixOcc & (1ul << b)) || cycle < radixMin[b]) radixMin[b] = cycle;
+        radixOcc |= 1ul << b;
+    }
+
+    inline uint64_t farFirstCycle() const {
+        assert(farElems);
+        return (farMode == PQ_FAR_MAP) ? feMap.begin()->first : radixMin[__builtin_ctzl(radixOcc)];
+    }
+
+    //Move every far element with cycle < (curBlock + B) * 64 to blocks[]
+    void refill() {
+        uint64_t topCycle = (curBlock + B) * 64;
+        if (farMode == PQ_FAR_MAP) {
+            FEMapIterator it = feMap.begin();
+            while (it != feMap.end() && it->first < topCycle) {
+                nearEnqueue(it->second, it->first);
+                it++;
+                farElems--;
+            }
+            feMap.erase(feMap.begin(), it);
+        } else {
+            while (radixOcc && radixMin[__builtin_ctzl(radixOcc)] < topCycle) {
+                uint32_t b = __builtin_ctzl(radixOcc);
+                T *list = radixBuckets[b];
+                radixBuckets[b] = nullptr;
+                radixOcc ^= 1ul << b;
+                radixLast = radixMin[b];
+                while (list) {
+                    T *obj = list;
+                    list = list->next;
+                    obj->next = nullptr;
+                    if (obj->privCycle < topCycle) {
+                        nearEnqueue(obj, obj->privCycle);
+                        farElems--;
+                    } else {
+                        radixEnqueue(obj, obj->privCycle);
+                    }
+                }
+            }
+        }
+    }
 
 public:
     PrioQueue() {
+        for (uint32_t w = 0; w < B / 64; w++) blockOcc[w] = 0;
+        for (uint32_t b = 0; b < 64; b++) radixBuckets[b] = nullptr;
+        radixOcc = 0;
+        radixLast = 0;
+        farMode = PQ_FAR_RADIX;
         curBlock = 0;
         elems = 0;
+        farElems = 0;
+    }
+
+    void setFarMode(PQFarMode mode) {
+        assert(!elems);
+        farMode = mode;
     }
 
     void enqueue(T *obj, uint64_t cycle) {
@@ -81,43 +189,42 @@ public:
         assert(absBlock >= curBlock);
 
         if (absBlock < curBlock + B) {
-            uint32_t i = absBlock % B;
-            uint32_t offset = cycle % 64;
-            blocks[i].enqueue(obj, offset);
+            nearEnqueue(obj, cycle);
         } else {
             //info("XXX far enq() %ld", cycle);
-            feMap.insert(std::pair<uint64_t, T *>(cycle, obj));
+            if (farMode == PQ_FAR_MAP) feMap.insert(std::pair<uint64_t, T *>(cycle, obj));
+            else radixEnqueue(obj, cycle);
+            farElems++;
         }
         elems++;
     }
 
     T *dequeue(uint64_t &deqCycle) {
         assert(elems);
+        if (elems == farElems) {
+            //Window is empty, so skip straight to the first far element instead of walking empty blocks.
+            //Refilling here and every B/2 blocks still moves each far element in before the walk reaches it.
+            curBlock = MAX(curBlock, farFirstCycle() / 64);
+            refill();
+        }
         while (!blocks[curBlock % B].occ) {
-            curBlock++;
-            if ((curBlock % (B / 2)) == 0 && !feMap.empty()) {
-                uint64_t topCycle = (curBlock + B) * 64;
-                //Move every element with cycle < topCycle to blocks[]
-                FEMapIterator it = feMap.begin();
-                while (it != feMap.end() && it->first < topCycle) {
-                    uint64_t cycle = it->first;
-                    T *obj = it->second;
-
-                    uint64_t absBlock = cycle / 64;
-                    assert(absBlock >= curBlock);
-                    assert(absBlock < curBlock + B);
-                    uint32_t i = absBlock % B;
-                    uint32_t offset = cycle % 64;
-                    blocks[i].enqueue(obj, offset);
-                    it++;
-                }
-                feMap.erase(feMap.begin(), it);
+            uint64_t nextBlock = curBlock + nearDistance();
+            //Refill at every B/2 block boundary on the way, since far elements may precede nextBlock
+            uint64_t boundary = curBlock - curBlock % (B / 2) + B / 2;
+            if (farElems && nextBlock >= boundary) {
+                curBlock = boundary;
+                refill();
+            } else {
+                assert(nextBlock < curBlock + B);
+                curBlock = nextBlock;
             }
         }
 
         //We're now at the first populated block
+        uint32_t i = curBlock % B;
         uint32_t offset;
-        T *obj = blocks[curBlock % B].dequeue(offset);
+        T *obj = blocks[i].dequeue(offset);
+        if (!blocks[i].occ) blockOcc[i / 64] &= ~(1ul << (i % 64));
         elems--;
 
         deqCycle = curBlock * 64 + offset;
@@ -130,23 +237,12 @@ public:
 
     inline uint64_t firstCycle() const {
         assert(elems);
-        for (uint32_t i = 0; i < B / 2; i++) {
-            uint64_t occ = blocks[(curBlock + i) % B].occ;
-            if (occ) {
-                uint64_t pos = __builtin_ctzl(occ);
-                return (curBlock + i) * 64 + pos;
-            }
-        }
-        for (uint32_t i = B / 2; i < B; i++) { //beyond B/2 blocks, there may be a far element that comes earlier
-            uint64_t occ = blocks[(curBlock + i) % B].occ;
-            if (occ) {
-                uint64_t pos = __builtin_ctzl(occ);
-                uint64_t cycle = (curBlock + i) * 64 + pos;
-                return feMap.empty() ? cycle : MIN(cycle, feMap.begin()->first);
-            }
-        }
-
-        return feMap.begin()->first;
+        if (elems == farElems) return farFirstCycle();
+        uint32_t i = nearDistance();
+        assert(i < B);
+        uint64_t cycle = (curBlock + i) * 64 + __builtin_ctzl(blocks[(curBlock + i) % B].occ);
+        //beyond B/2 blocks, there may be a far element that comes earlier
+        return (i >= B / 2 && farElems) ? MIN(cycle, farFirstCycle()) : cycle;
     }
 };
 
@@ -30,6 +30,7 @@
 SimpleCore::SimpleCore(FilterCache *_l1i, FilterCache *_l1d, g_string &_name) : Core(_name), l1i(_l1i), l1d(_l1d),
                                                                                 instrs(0), curCycle(0),
                                                                                 haltedCycles(0) {
+    lineValue = gm_memalign<char>(CACHE_LINE_BYTES, zinfo->lineSize);
 }
 
 void SimpleCore::initStats(AggregateStat *parentStat) {
@@ -60,6 +61,14 @@ void SimpleCore::store(Address addr, Address pc /*Kasraa*/, void* value, UINT32
     curCycle = l1d->store(addr, curCycle, pc /*Kasraa*/, value, size);
 }
 
+// Same as OOOCore::captureLine()
+inline void *SimpleCore::captureLine(Address addr) {
+    if (!zinfo->dataAwareCaches) return nullptr;
+    ADDRINT lineBegin = (addr >> lineBits) << lineBits;
+    PIN_SafeCopy(lineValue, (ADDRINT *) lineBegin, 1U << lineBits);
+    return lineValue;
+}
+
 void SimpleCore::bbl(Address bblAddr, BblInfo *bblInfo) {
     //info("BBL %s %p", name.c_str(), bblInfo);
     //info("%d %d", bblInfo->instrs, bblInfo->bytes);
@@ -68,17 +77,9 @@ void SimpleCore::bbl(Address bblAddr, BblInfo *bblInfo) {
 
     Address endBblAddr = bblAddr + bblInfo->bytes;
     for (Address fetchAddr = bblAddr; fetchAddr < endBblAddr; fetchAddr += (1 << lineBits)) {
-
-        unsigned int lineSize = (unsigned int) 1 << lineBits;
-        char * value = new char[lineSize];
-        ADDRINT lineBegin = (fetchAddr >> lineBits) << lineBits;
-        PIN_SafeCopy(value, (ADDRINT*) lineBegin, lineSize);
-
         curCycle = l1i->load(fetchAddr, curCycle,
                              fetchAddr /*Kasraa: This is instruction cache and the PC is not required*/,
-                             value, lineSize);
-
-        delete[] value;
+                             captureLine(fetchAddr), 1U << lineBits);
     }
 }
 
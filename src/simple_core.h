@@ -44,6 +44,8 @@ protected:
     uint64_t phaseEndCycle; //next stopping point
     uint64_t haltedCycles;
 
+    char *lineValue;  // instruction fetch values for the data-aware cache arrays, see OOOCore
+
 public:
     SimpleCore(FilterCache *_l1i, FilterCache *_l1d, g_string &_name);
 
@@ -69,6 +71,8 @@ protected:
 
     inline void bbl(Address bblAddr, BblInfo *bblInstrs);
 
+    inline void *captureLine(Address addr);
+
     static void LoadFunc(THREADID tid, ADDRINT addr, ADDRINT pc /*Kasraa*/, void* value, UINT32 size);
 
     static void StoreFunc(THREADID tid, ADDRINT addr, ADDRINT pc /*Kasraa*/, void* value, UINT32 size);
@@ -31,7 +31,9 @@
 //#define DEBUG_MSG(args...) info(args)
 
 TimingCore::TimingCore(FilterCache *_l1i, FilterCache *_l1d, uint32_t _domain, g_string &_name)
-        : Core(_name), l1i(_l1i), l1d(_l1d), instrs(0), curCycle(0), cRec(_domain, _name) {}
+        : Core(_name), l1i(_l1i), l1d(_l1d), instrs(0), curCycle(0), cRec(_domain, _name) {
+    lineValue = gm_memalign<char>(CACHE_LINE_BYTES, zinfo->lineSize);
+}
 
 uint64_t TimingCore::getPhaseCycles() const {
     return curCycle % zinfo->phaseLength;
@@ -89,6 +91,14 @@ void TimingCore::storeAndRecord(Address addr, Address pc /*Kasraa*/, void *value
     cRec.record(startCycle);
 }
 
+// Same as OOOCore::captureLine()
+inline void *TimingCore::captureLine(Address addr) {
+    if (!zinfo->dataAwareCaches) return nullptr;
+    ADDRINT lineBegin = (addr >> lineBits) << lineBits;
+    PIN_SafeCopy(lineValue, (ADDRINT *) lineBegin, 1U << lineBits);
+    return lineValue;
+}
+
 void TimingCore::bblAndRecord(Address bblAddr, BblInfo *bblInfo) {
     instrs += bblInfo->instrs;
     curCycle += bblInfo->instrs;
@@ -96,18 +106,9 @@ void TimingCore::bblAndRecord(Address bblAddr, BblInfo *bblInfo) {
     Address endBblAddr = bblAddr + bblInfo->bytes;
     for (Address fetchAddr = bblAddr; fetchAddr < endBblAddr; fetchAddr += (1 << lineBits)) {
         uint64_t startCycle = curCycle;
-
-        unsigned int lineSize = (unsigned int) 1 << lineBits;
-        char * value = new char[lineSize];
-        ADDRINT lineBegin = (fetchAddr >> lineBits) << lineBits;
-        PIN_SafeCopy(value, (ADDRINT*) lineBegin, lineSize);
-
         curCycle = l1i->load(fetchAddr, curCycle,
                              fetchAddr /*Kasraa: This is instruction cache and the PC is not required*/,
-                             value, lineSize);
-
-        delete[] value;
-
+                             captureLine(fetchAddr), 1U << lineBits);
         cRec.record(startCycle);
     }
 }
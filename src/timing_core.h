@@ -46,6 +46,8 @@ private:
 
     CoreRecorder cRec;
 
+    char *lineValue;  // instruction fetch values for the data-aware cache arrays, see OOOCore
+
 public:
     TimingCore(FilterCache *_l1i, FilterCache *_l1d, uint32_t domain, g_string &_name);
 
@@ -79,6 +81,8 @@ private:
 
     inline void bblAndRecord(Address bblAddr, BblInfo *bblInstrs);
 
+    inline void *captureLine(Address addr);
+
     inline void record(uint64_t startCycle);
 
     static void LoadAndRecordFunc(THREADID tid, ADDRINT addr, ADDRINT pc /*Kasraa*/, void* value, UINT32 size);
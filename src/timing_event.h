@@ -69,7 +69,7 @@ class CrossingEvent;
 
 class TimingEvent {
 private:
-    uint64_t privCycle; //only touched by ContentionSim
+    uint64_t privCycle; //only touched by ContentionSim and its PrioQueues
 
 public:
     TimingEvent *next; //used by PrioQueue --- PRIVATE
@@ -303,6 +303,8 @@ protected:
 
     friend class ContentionSim;
 
+    template<typename T, uint32_t B> friend class PrioQueue; //uses privCycle for far events
+
     friend class DelayEvent; //DelayEvent is, for now, the only child of TimingEvent that should do anything other than implement simulate
     friend class CrossingEvent;
 };
@@ -51,6 +51,8 @@
 #include "galloc.h"
 #include "init.h"
 #include "log.h"
+#include "mc_telemetry.h"
+#include "mc_tracing.h"
 #include "pin.H"
 #include "pin_cmd.h"
 #include "process_tree.h"
@@ -103,13 +105,6 @@ uint32_t procIdx;
 uint32_t lineBits; //process-local for performance, but logically global
 Address procMask;
 
-unsigned long total_evictions;
-unsigned long dirty_line_evictions;
-unsigned long dirty_word_evictions;
-unsigned long zero_line_evictions;
-unsigned long dirty_line_zero_word_evictions;
-unsigned long write_count_sum;
-
 static ProcessTreeNode *procTreeNode;
 
 //tid to cid translation
@@ -180,16 +175,72 @@ VOID FFThread(VOID *arg);
 
 InstrFuncPtrs fPtrs[MAX_THREADS] ATTR_LINE_ALIGNED; //minimize false sharing
 
-void * folan = new char[64];
+/* Values of the accessed lines, for the data-aware cache arrays. The analysis
+ * routines snapshot the line of each load and store when the instruction
+ * executes, into a per-thread ring, and pass the snapshot down as the access
+ * value, so cores need not copy anything. Cores consume the snapshots at most
+ * one bbl later (OOOCore records up to 256 loads and 256 stores), well before
+ * the ring wraps around. Without data-aware arrays nothing is captured, and
+ * the value is null. Threads on NOP pointers (fast-forwarding, descheduled,
+ * retrying) drop their accesses, so they skip the copy too.
+ *
+ * A store's snapshot is taken before the store, and patched with the stored
+ * bytes right after it executes (StoreValuePost), so cores that simulate the
+ * store later (OOOCore) see exactly what it wrote.
+ */
+#define VALUE_RING_LINES 1024  // power of 2
+
+struct ValueRing {
+    char *lines;
+    uint32_t head;
+    // Snapshot of the store being executed, if any, for StoreValuePost
+    char *storeLine;
+    ADDRINT storeAddr;
+    UINT32 storeSize;
+} ATTR_LINE_ALIGNED;
+
+ValueRing valueRings[MAX_THREADS];
+static bool captureValues;  // process-local copy of zinfo->dataAwareCaches
+
+static inline void *CaptureValue(THREADID tid, ADDRINT addr) {
+#if VALUE_TRACKING
+    uint64_t type = fPtrs[tid].type;  // same line as the pointer we are about to call
+    if (!captureValues || (type != FPTR_ANALYSIS && type != FPTR_JOIN)) return nullptr;
+    ValueRing &r = valueRings[tid];
+    char *line = r.lines + ((r.head++ & (VALUE_RING_LINES - 1)) << lineBits);
+    PIN_SafeCopy(line, (void *) ((addr >> lineBits) << lineBits), 1U << lineBits);
+    return line;
+#else
+    return nullptr;
+#endif
+}
+
+static inline void *CaptureStoreValue(THREADID tid, ADDRINT addr, UINT32 size, BOOL executing = true) {
+    char *line = executing ? (char *) CaptureValue(tid, addr) : nullptr;
+    ValueRing &r = valueRings[tid];
+    r.storeLine = line;
+    r.storeAddr = addr;
+    r.storeSize = size;
+    return line;
+}
+
+// IPOINT_AFTER (or IPOINT_TAKEN_BRANCH) of every store, when capturing values
+VOID PIN_FAST_ANALYSIS_CALL StoreValuePost(THREADID tid) {
+    ValueRing &r = valueRings[tid];
+    if (!r.storeLine) return;  // not captured, or predicated off
+    uint32_t offset = r.storeAddr & ((1U << lineBits) - 1);
+    PIN_SafeCopy(r.storeLine + offset, (void *) r.storeAddr, MIN(r.storeSize, (1U << lineBits) - offset));
+    r.storeLine = nullptr;
+}
 
 VOID PIN_FAST_ANALYSIS_CALL
 IndirectLoadSingle(THREADID tid, ADDRINT addr, ADDRINT pc /*Kasraa*/, UINT32 memory_read_size) {
-    fPtrs[tid].loadPtr(tid, addr, pc /*Kasraa*/, folan , memory_read_size);
+    fPtrs[tid].loadPtr(tid, addr, pc /*Kasraa*/, CaptureValue(tid, addr), memory_read_size);
 }
 
 VOID PIN_FAST_ANALYSIS_CALL
 IndirectStoreSingle(THREADID tid, ADDRINT addr, ADDRINT pc /*Kasraa*/, UINT32 memory_write_size) {
-    fPtrs[tid].storePtr(tid, addr, pc /*Kasraa*/, folan , memory_write_size);
+    fPtrs[tid].storePtr(tid, addr, pc /*Kasraa*/, CaptureStoreValue(tid, addr, memory_write_size), memory_write_size);
 }
 
 VOID PIN_FAST_ANALYSIS_CALL IndirectBasicBlock(THREADID tid, ADDRINT bblAddr, BblInfo *bblInfo) {
@@ -203,12 +254,14 @@ IndirectRecordBranch(THREADID tid, ADDRINT branchPc, BOOL taken, ADDRINT takenNp
 
 VOID PIN_FAST_ANALYSIS_CALL
 IndirectPredLoadSingle(THREADID tid, ADDRINT addr, ADDRINT pc /*Kasraa*/, BOOL pred, UINT32 memory_read_size) {
-    fPtrs[tid].predLoadPtr(tid, addr, pc /*Kasraa*/, folan, memory_read_size, pred);
+    fPtrs[tid].predLoadPtr(tid, addr, pc /*Kasraa*/, pred ? CaptureValue(tid, addr) : nullptr, memory_read_size,
+                           pred);
 }
 
 VOID PIN_FAST_ANALYSIS_CALL
 IndirectPredStoreSingle(THREADID tid, ADDRINT addr, ADDRINT pc /*Kasraa*/, BOOL pred, UINT32 memory_write_size) {
-    fPtrs[tid].predStorePtr(tid, addr, pc /*Kasraa*/, folan , memory_write_size, pred);
+    fPtrs[tid].predStorePtr(tid, addr, pc /*Kasraa*/, CaptureStoreValue(tid, addr, memory_write_size, pred),
+                            memory_write_size, pred);
 }
 
 //Non-simulation variants of analysis functions
@@ -600,6 +653,19 @@ VOID Instruction(INS ins) {
                                IARG_MEMORYWRITE_EA, IARG_INST_PTR /*Kasraa*/, IARG_EXECUTING, IARG_MEMORYWRITE_SIZE,
                                IARG_END);
             }
+#if VALUE_TRACKING
+            // Patch the store's value snapshot with the bytes it wrote
+            if (captureValues) {
+                if (INS_HasFallThrough(ins)) {
+                    INS_InsertCall(ins, IPOINT_AFTER, (AFUNPTR) StoreValuePost, IARG_FAST_ANALYSIS_CALL,
+                                   IARG_THREAD_ID, IARG_END);
+                }
+                if (INS_IsBranchOrCall(ins)) {
+                    INS_InsertCall(ins, IPOINT_TAKEN_BRANCH, (AFUNPTR) StoreValuePost, IARG_FAST_ANALYSIS_CALL,
+                                   IARG_THREAD_ID, IARG_END);
+                }
+            }
+#endif
         }
 
         // Instrument only conditional branches
@@ -886,6 +952,14 @@ void SimThreadStart(THREADID tid) {
 }
 
 VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v) {
+    // Any thread may be simulated later on (e.g., after fast-forwarding), so all of them get a value ring
+    if (captureValues && !valueRings[tid].lines) {
+        void *lines;
+        if (posix_memalign(&lines, CACHE_LINE_BYTES, VALUE_RING_LINES << lineBits)) panic("Could not allocate value ring");
+        valueRings[tid].lines = static_cast<char *>(lines);
+        valueRings[tid].head = 0;
+    }
+
     /* This should only fire for the first thread; I know this is a callback,
      * everything is serialized etc; that's the point, we block everything.
      * It's here and not in main() because that way the auxiliary threads can
@@ -1163,6 +1237,8 @@ VOID SimEnd() {
         zinfo->trigger = 20000;
         for (StatsBackend *backend : *(zinfo->statsBackends)) backend->dump(false /*unbuffered, write out*/);
         for (AccessTraceWriter *t : *(zinfo->traceWriters)) t->dump(false);  // flushes trace writer
+        for (MCTraceWriter *t : *(zinfo->mcTraceWriters)) t->finish();  // drains rings, finalizes the file
+        for (MCTelemetryWriter *t : *(zinfo->mcTelemetryWriters)) t->finish();
 
         if (zinfo->sched) zinfo->sched->notifyTermination();
     }
@@ -1170,11 +1246,6 @@ VOID SimEnd() {
     //Uncomment when debugging termination races, which can be rare because they are triggered by threads of a dying process
     //sleep(5);
 
-    std::cerr <<  (double) zero_line_evictions / dirty_line_evictions << std::endl;
-    std::cerr <<  (double) dirty_line_zero_word_evictions / (dirty_line_evictions * 8) << std::endl;
-    std::cerr <<  (double) dirty_word_evictions  / total_evictions << std::endl;
-    std::cerr <<  (double) write_count_sum / total_evictions << std::endl;
-
     exit(0);
 }
 
@@ -1559,13 +1630,7 @@ int main(int argc, char *argv[]) {
 
     lineBits = ilog2(zinfo->lineSize);
     procMask = ((uint64_t) procIdx) << (64 - lineBits);
-
-    total_evictions = 0;
-    dirty_line_evictions = 0;
-    dirty_word_evictions = 0;
-    zero_line_evictions = 0;
-    dirty_line_zero_word_evictions = 0;
-    write_count_sum = 0;
+    captureValues = zinfo->dataAwareCaches;
 
     //Initialize process-local per-thread state, even if ThreadStart does so later
     for (uint32_t i = 0; i < MAX_THREADS; i++) {
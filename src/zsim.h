@@ -61,6 +61,9 @@ class VectorCounter;
 
 class AccessTraceWriter;
 
+class MCTraceWriter;
+class MCTelemetryWriter;
+
 class TraceDriver;
 
 template<typename T>
@@ -194,10 +197,22 @@ struct GlobSimInfo {
 
     // Trace writers (stored globally because they need to be deleted when the simulation ends)
     g_vector<AccessTraceWriter *> *traceWriters;
+    g_vector<MCTraceWriter *> *mcTraceWriters;  // MemoryController request traces, drained by proc 0 at the end
+    g_vector<MCTelemetryWriter *> *mcTelemetryWriters;  // MemoryController telemetry, written out by proc 0 at the end
 
     // Trace-driven simulation (no cores)
     bool traceDriven;
     TraceDriver *traceDriver;
+
+    // Some cache array keeps line values (DataAwareSetAssoc, CompressedDataAwareSetAssoc); otherwise, cores
+    // do not capture the values of the lines they access
+#if VALUE_TRACKING
+    bool dataAwareCaches;
+#else
+    static constexpr bool dataAwareCaches = false;
+#endif
+    // Some data-aware array detects silent stores; cores must then pass post-store values (only OOOCore does)
+    bool silentStores;
 };
 
 
@@ -207,13 +222,6 @@ extern uint32_t procIdx;
 extern uint32_t lineBits; //process-local for performance, but logically global
 extern uint64_t procMask;
 
-extern unsigned long total_evictions;
-extern unsigned long dirty_line_evictions;
-extern unsigned long dirty_word_evictions;
-extern unsigned long zero_line_evictions;
-extern unsigned long dirty_line_zero_word_evictions;
-extern unsigned long write_count_sum;
-
 extern GlobSimInfo *zinfo;
 
 //Process-wide functions, defined in zsim.cpp
@@ -355,8 +355,11 @@ int main(int argc, char *argv[]) {
     if (removedLogfiles) info("Removed %d old logfiles", removedLogfiles);
 
     uint32_t gmSize = conf.get<uint32_t>("sim.gmMBytes", (1 << 10) /*default 1024MB*/);
-    info("Creating global segment, %d MBs", gmSize);
-    int shmid = gm_init(((size_t) gmSize) << 20 /*MB to Bytes*/);
+    uint32_t gmSegments = conf.get<uint32_t>("sim.gmSegments", 4); // the heap grows into these as needed
+    uint32_t gmFlags = (conf.get<bool>("sim.gmHugePages", false) ? GM_HUGEPAGES : 0) |
+                       (conf.get<bool>("sim.gmPrefault", false) ? GM_PREFAULT : 0);
+    info("Creating global segment, %d MBs, up to %d segments", gmSize, gmSegments);
+    int shmid = gm_init(((size_t) gmSize) << 20 /*MB to Bytes*/, gmSegments, gmFlags);
     info("Global segment shmid = %d", shmid);
     //fprintf(stderr, "%sGlobal segment shmid = %d\n", logHeader, shmid); //hack to print shmid on both streams
     //fflush(stderr);